@@ -18,6 +18,7 @@
 #include "ekamdashboardconstants.h"
 #include "ekamtreewidget.h"
 
+#include <capnp/serialize.h>
 #include <capnp/serialize-async.h>
 #include <kj/debug.h>
 #include <deque>
@@ -258,20 +259,41 @@ kj::Promise<void> EkamDashboardPlugin::messageLoop() {
       ekam::proto::Header::Reader header = message->getRoot<ekam::proto::Header>();
     //  qDebug() << "Received header: " << kj::str(header).cStr();
       projectRoot = toQString(header.getProjectRoot());
+
+      // Snapshot entries carry only log tails, so ask for the full logs of finished tasks in
+      // order to find all their errors.
+      kj::Vector<uint> needFullLog;
+      for (ekam::proto::TaskUpdate::Reader update : header.getTasks()) {
+        applyUpdate(update);
+        if (update.getLogIsTail() &&
+            update.getState() != ekam::proto::TaskUpdate::State::PENDING &&
+            update.getState() != ekam::proto::TaskUpdate::State::RUNNING) {
+          needFullLog.add(update.getId());
+        }
+      }
+      {
+        // The default subscription leaves out silent tasks that haven't failed, which we'd
+        // hide anyway.
+        capnp::MallocMessageBuilder request;
+        auto root = request.getRoot<ekam::proto::ClientMessage>();
+        root.setFetchLog(needFullLog.asPtr());
+        root.initSubscribe();
+        kj::Array<capnp::word> words = capnp::messageToFlatArray(request);
+        socket->write(reinterpret_cast<const char*>(words.begin()),
+                      words.size() * sizeof(capnp::word));
+      }
     } else {
       ekam::proto::TaskUpdate::Reader update = message->getRoot<ekam::proto::TaskUpdate>();
     //  qDebug() << "Received task update: " << kj::str(update).cStr();
-
-      ActionState*& slot = actions[update.getId()];
-      if (slot == 0) {
-        slot = new ActionState(this, update);
-      } else {
-        slot->applyUpdate(update);
-      }
-
-      if (slot->isDead()) {
-        delete slot;
-        actions.remove(update.getId());
+      applyUpdate(update);
+
+      if (update.getLogIsTail()) {
+        // A silent task failed and came into view with only the end of its log.
+        capnp::MallocMessageBuilder request;
+        request.getRoot<ekam::proto::ClientMessage>().initFetchLog(1).set(0, update.getId());
+        kj::Array<capnp::word> words = capnp::messageToFlatArray(request);
+        socket->write(reinterpret_cast<const char*>(words.begin()),
+                      words.size() * sizeof(capnp::word));
       }
     }
 
@@ -279,6 +301,20 @@ kj::Promise<void> EkamDashboardPlugin::messageLoop() {
   });
 }
 
+void EkamDashboardPlugin::applyUpdate(ekam::proto::TaskUpdate::Reader update) {
+  ActionState*& slot = actions[update.getId()];
+  if (slot == 0) {
+    slot = new ActionState(this, update);
+  } else {
+    slot->applyUpdate(update);
+  }
+
+  if (slot->isDead()) {
+    delete slot;
+    actions.remove(update.getId());
+  }
+}
+
 QString EkamDashboardPlugin::findFile(const QString& canonicalPath) {
   QString srcpath = projectRoot + QLatin1String("/src/") + canonicalPath;
   QString tmppath = projectRoot + QLatin1String("/tmp/") + canonicalPath;
@@ -359,6 +395,10 @@ void ActionState::applyUpdate(ekam::proto::TaskUpdate::Reader update) {
       }
     }
   }
+  if (update.getLogIsComplete()) {
+    // Full log requested from Ekam; replaces what we've seen so far.
+    clearTasks();
+  }
   auto log = update.getLog();
   if (log != nullptr) {
     consumeLog(log);
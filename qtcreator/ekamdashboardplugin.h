@@ -141,6 +141,7 @@ private:
   void reset();
   void tryConnect();
   kj::Promise<void> messageLoop();
+  void applyUpdate(ekam::proto::TaskUpdate::Reader update);
   void clearActions();
 };
 
@@ -33,6 +33,8 @@ char HexDigit(unsigned int value) {
   }
 }
 
+uint64_t bytesHashed = 0;
+
 } // anonymous namespace
 
 Hash Hash::of(const std::string& data) {
@@ -43,9 +45,21 @@ Hash Hash::of(void* data, size_t size) {
   return Builder().add(data, size).build();
 }
 
+uint64_t Hash::getBytesHashed() {
+  return bytesHashed;
+}
+
 // Note:  Since this is in static space it will be automatically initialized to zero.
 const Hash Hash::NULL_HASH;
 
+const size_t Hash::SIZE;
+
+Hash Hash::fromBytes(const void* bytes) {
+  Hash result;
+  memcpy(result.hash, bytes, SIZE);
+  return result;
+}
+
 std::string Hash::toString() const {
   std::string result;
   result.reserve(sizeof(hash) * 2);
@@ -62,11 +76,13 @@ Hash::Builder::Builder() {
 
 Hash::Builder& Hash::Builder::add(const std::string& data) {
   SHA256_Update(&context, data.data(), data.size());
+  bytesHashed += data.size();
   return *this;
 }
 
 Hash::Builder& Hash::Builder::add(void* data, size_t size) {
   SHA256_Update(&context, data, size);
+  bytesHashed += size;
   return *this;
 }
 
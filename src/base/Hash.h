@@ -42,8 +42,16 @@ public:
 
   static Hash of(const std::string& data);
   static Hash of(void* data, size_t size);
+
+  // Total bytes hashed by this process so far, for metrics.
+  static uint64_t getBytesHashed();
   static const Hash NULL_HASH;
 
+  // The raw hash is SIZE bytes long.  These are for e.g. storing hashes on disk.
+  static const size_t SIZE = 32;
+  static Hash fromBytes(const void* bytes);
+  inline const unsigned char* bytes() const { return hash; }
+
   std::string toString() const;
 
   inline bool operator==(const Hash& other) const {
@@ -74,7 +82,7 @@ public:
 
 private:
   union {
-    unsigned char hash[32];
+    unsigned char hash[SIZE];
     size_t shortHash;
   };
 };
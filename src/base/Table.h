@@ -267,6 +267,12 @@ public:
     return rows.capacity();
   }
 
+  // Rows erased but not yet compacted away.  These still take up space, and searches skip
+  // over them.
+  int deletedRows() {
+    return deletedCount;
+  }
+
   template <int columnNumber>
   int indexSize() {
     return Column<columnNumber>::index(this)->size();
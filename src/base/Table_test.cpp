@@ -164,18 +164,21 @@ void testTable() {
     }
 
     ASSERT(table.size() == 150);
+    ASSERT(table.deletedRows() == 0);
     ASSERT(table.capacity() >= 150);
     ASSERT(table.indexSize<0>() == 150);
     ASSERT(table.indexSize<1>() == 150);
     table.erase<0>(123);
 
     ASSERT(table.size() == 100);
+    ASSERT(table.deletedRows() == 50);
     ASSERT(table.capacity() >= 150);
     ASSERT(table.indexSize<0>() == 100);
     ASSERT(table.indexSize<1>() == 150);
     table.erase<0>(456);
 
     ASSERT(table.size() == 50);
+    ASSERT(table.deletedRows() == 0);
     ASSERT(table.capacity() == 50);
     ASSERT(table.indexSize<0>() == 50);
     ASSERT(table.indexSize<1>() == 50);
@@ -22,6 +22,18 @@ BuildContext::~BuildContext() noexcept(false) {}
 Action::~Action() {}
 ActionFactory::~ActionFactory() {}
 
+std::string ActionFactory::getIdentity() {
+  return std::string();
+}
+
+void ActionFactory::tryMakeActions(const Tag& id, File* file,
+                                   OwnedPtrVector<Action>::Appender output) {
+  OwnedPtr<Action> action = tryMakeAction(id, file);
+  if (action != nullptr) {
+    output.add(action.release());
+  }
+}
+
 const int BuildContext::INSTALL_LOCATION_COUNT;
 const char* const BuildContext::INSTALL_LOCATION_NAMES[INSTALL_LOCATION_COUNT] = {
   "bin", "lib", "node_modules"
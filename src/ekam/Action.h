@@ -45,6 +45,20 @@ public:
   virtual File* findProvider(Tag id) = 0;
   virtual File* findInput(const std::string& path) = 0;
 
+  // Notes that the action read the given file from outside the source tree and tmp, e.g. a
+  // system header or the compiler itself.  `path` is absolute, or under `deps/`.  The file is
+  // not tracked for changes, but the action's outcome is only reused (see Driver) while the
+  // file's content is the same as when it was read.
+  virtual void noteInput(const std::string& path) = 0;
+
+  // Finds the file with the given canonical name, which should contain a list of names, one
+  // per line, and returns Tag::fromName(prefix + name) for each.  The file is recorded as a
+  // dependency like with findProvider().  The result is cached until the file changes, so
+  // this is much cheaper than reading the file directly when many actions read the same list.
+  // Returns null if there is no such file.
+  virtual const std::vector<Tag>* findTagList(const std::string& canonicalName,
+                                              const std::string& prefix) = 0;
+
   enum InstallLocation {
     BIN,
     LIB,
@@ -62,6 +76,11 @@ public:
 
   virtual void addActionType(OwnedPtr<ActionFactory> factory) = 0;
 
+  // Requests up to `count` additional "-j" slots for this action, e.g. so that it can run
+  // several independent subprocesses at once.  Never waits:  returns the number of slots
+  // actually granted, which may be zero.  The slots are held until the action completes.
+  virtual int acquireSlots(int count) = 0;
+
   virtual void passed() = 0;
   virtual void failed() = 0;
 };
@@ -71,7 +90,23 @@ public:
   virtual ~Action();
 
   virtual bool isSilent() { return false; }
+
+  // Returns true if the action does all its work inside the Ekam process without blocking
+  // (e.g. it only tags files).  Such actions do not occupy one of the "-j" slots; the driver
+  // runs them immediately, in batches, ahead of everything else.  start() must complete the
+  // action before returning -- it must not wait on any events.
+  virtual bool isInProcess() { return false; }
+
+  // Returns true if the action must run even when building only specific targets, because
+  // nothing else can be built without it (e.g. learning a rule).
+  virtual bool isAlwaysNeeded() { return false; }
+
   virtual std::string getVerb() = 0;
+
+  // If several actions are created from the same trigger, each for a different variant of the
+  // output (e.g. a different cross-compile target), this distinguishes them for display.
+  virtual std::string getVariant() { return std::string(); }
+
   virtual Promise<void> start(EventManager* eventManager, BuildContext* context) = 0;
 };
 
@@ -81,6 +116,17 @@ public:
 
   virtual void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter) = 0;
   virtual OwnedPtr<Action> tryMakeAction(const Tag& id, File* file) = 0;
+
+  // Like tryMakeAction() but may produce any number of actions, which are scheduled
+  // independently.  The default implementation calls tryMakeAction().
+  virtual void tryMakeActions(const Tag& id, File* file,
+                              OwnedPtrVector<Action>::Appender output);
+
+  // Identifies what this factory's actions do, so that the outcome of an action can be reused
+  // in place of running an identical one later -- possibly in a later Ekam process.  Factories
+  // with equal identities must make actions that behave identically given identical inputs.
+  // The default, an empty string, means outcomes must never be reused.
+  virtual std::string getIdentity();
 };
 
 }  // namespace ekam
@@ -20,6 +20,9 @@
 #include <termios.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <algorithm>
+#include <unistd.h>
 
 #include "base/Debug.h"
 
@@ -182,6 +185,7 @@ public:
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
 
 private:
   ConsoleDashboard* dashboard;
@@ -189,10 +193,16 @@ private:
   Silence silence;
   std::string verb;
   std::string noun;
+  bool hasUsage;
+  ResourceUsage usage;
+
+  // Only the first maxDisplayedLogLines lines are ever displayed, so there's no need to keep
+  // much more than that.
   std::string outputText;
+  bool outputTruncated;
 
   void removeFromRunning();
-  void writeFinalLog(Color verbColor, const char* icon);
+  bool writeFinalLog(Color verbColor, const char* icon);  // returns false if nothing written
 
   friend class ConsoleDashboard;
 };
@@ -200,12 +210,12 @@ private:
 ConsoleDashboard::TaskImpl::TaskImpl(ConsoleDashboard* dashboard,
                                      const std::string& verb, const std::string& noun,
                                      Silence silence)
-    : dashboard(dashboard), state(PENDING), silence(silence), verb(verb), noun(noun) {}
+    : dashboard(dashboard), state(PENDING), silence(silence), verb(verb), noun(noun),
+      hasUsage(false), outputTruncated(false) {}
 ConsoleDashboard::TaskImpl::~TaskImpl() {
-  if (state == RUNNING) {
-    dashboard->clearRunning();
+  if (state == RUNNING && silence != SILENT) {
     removeFromRunning();
-    dashboard->drawRunning();
+    dashboard->scheduleFrame();
   }
 }
 
@@ -214,42 +224,66 @@ void ConsoleDashboard::TaskImpl::setState(TaskState state) {
   // reason why we were blocked, so clear the text.
   if (this->state == BLOCKED && (state == PENDING || state == RUNNING)) {
     outputText.clear();
+    outputTruncated = false;
+  }
+  if (state == PENDING || state == RUNNING) {
+    hasUsage = false;
   }
 
-  if (this->state == RUNNING) {
-    if (silence != SILENT) removeFromRunning();
+  // Only bother drawing a frame if something visible changed, which is rarely the case for
+  // silent tasks.
+  bool changed = false;
+
+  if (this->state == RUNNING && silence != SILENT) {
+    removeFromRunning();
+    changed = true;
   }
 
   this->state = state;
 
-  dashboard->clearRunning();
-
   switch (state) {
     case PENDING:
       // Don't display.
       break;
     case RUNNING:
-      if (silence != SILENT) dashboard->runningTasks.push_back(this);
+      if (silence != SILENT) {
+        dashboard->runningTasks.push_back(this);
+        changed = true;
+      }
       break;
     case DONE:
-      writeFinalLog(DONE_COLOR, " ");
+      changed = writeFinalLog(DONE_COLOR, " ") || changed;
       break;
     case PASSED:
-      writeFinalLog(PASSED_COLOR, "✔");
+      changed = writeFinalLog(PASSED_COLOR, "✔") || changed;
       break;
     case FAILED:
-      writeFinalLog(FAILED_COLOR, "✘");
+      changed = writeFinalLog(FAILED_COLOR, "✘") || changed;
       break;
     case BLOCKED:
       // Don't display.
       break;
   }
 
-  dashboard->drawRunning();
+  if (changed) {
+    dashboard->scheduleFrame();
+  }
 }
 
 void ConsoleDashboard::TaskImpl::addOutput(const std::string& text) {
-  outputText.append(text);
+  // A displayed line is at most a screen wide; allow generously for that.
+  size_t limit = (dashboard->maxDisplayedLogLines + 1) * MAX_LINE_BYTES;
+  if (outputText.size() + text.size() <= limit) {
+    outputText.append(text);
+  } else if (!outputTruncated) {
+    outputText.append(text, 0, limit - outputText.size());
+    outputTruncated = true;
+  }
+}
+
+void ConsoleDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  hasUsage = true;
+  this->usage = usage;
 }
 
 void ConsoleDashboard::TaskImpl::removeFromRunning() {
@@ -262,29 +296,49 @@ void ConsoleDashboard::TaskImpl::removeFromRunning() {
   }
 }
 
-void ConsoleDashboard::TaskImpl::writeFinalLog(Color verbColor, const char* icon) {
+bool ConsoleDashboard::TaskImpl::writeFinalLog(Color verbColor, const char* icon) {
   // Silent tasks should not be written to the log, unless they had error messages.
   if (silence != SILENT || !outputText.empty()) {
-    fprintf(dashboard->out, "%s%s %s:%s %s\n",
-            ANSI_COLOR_CODES[verbColor], icon, verb.c_str(), ANSI_CLEAR_COLOR, noun.c_str());
+    std::string& log = dashboard->pendingLog;
+    log.append(ANSI_COLOR_CODES[verbColor]);
+    log.append(icon);
+    log.append(" ");
+    log.append(verb);
+    log.append(":");
+    log.append(ANSI_CLEAR_COLOR);
+    log.append(" ");
+    log.append(noun);
+    if (hasUsage) {
+      log.append(" ");
+      log.append(ANSI_COLOR_CODES[GRAY]);
+      log.append("(");
+      log.append(usage.toString());
+      log.append(")");
+      log.append(ANSI_CLEAR_COLOR);
+    }
+    log.append("\n");
 
     // Write any output we have buffered.
     if (!outputText.empty()) {
       LogFormatter formatter(outputText);
-      struct winsize windowSize;
-      ioctl(dashboard->fd, TIOCGWINSZ, &windowSize);
+      int windowWidth = dashboard->getWindowSize().ws_col;
 
       for (int i = 0; i < dashboard->maxDisplayedLogLines && !formatter.atEnd(); i++) {
-        std::string line = formatter.getLine(4, windowSize.ws_col);
-        fprintf(dashboard->out, "    %s\n", line.c_str());
+        log.append("    ");
+        log.append(formatter.getLine(4, windowWidth));
+        log.append("\n");
       }
 
-      if (!formatter.atEnd()) {
-        fprintf(dashboard->out, "    ...(log truncated; use -l to increase log limit)...\n");
+      if (!formatter.atEnd() || outputTruncated) {
+        log.append("    ...(log truncated; use -l to increase log limit)...\n");
       }
 
       outputText.clear();
+      outputTruncated = false;
     }
+    return true;
+  } else {
+    return false;
   }
 }
 
@@ -322,31 +376,111 @@ const ConsoleDashboard::Color ConsoleDashboard::PASSED_COLOR = BRIGHT_GREEN;
 const ConsoleDashboard::Color ConsoleDashboard::FAILED_COLOR = BRIGHT_RED;
 const ConsoleDashboard::Color ConsoleDashboard::RUNNING_COLOR = BRIGHT_FUCHSIA;
 
-ConsoleDashboard::ConsoleDashboard(FILE* output, int maxDisplayedLogLines)
-    : fd(fileno(output)), out(output), maxDisplayedLogLines(maxDisplayedLogLines),
-      runningTasksLineCount(0), lastDebugMessageCount(DebugMessage::getMessageCount()) {}
-ConsoleDashboard::~ConsoleDashboard() {}
+volatile sig_atomic_t ConsoleDashboard::windowSizeChanged = 1;
+
+void ConsoleDashboard::handleWindowSizeChange(int signum) {
+  windowSizeChanged = 1;
+}
+
+ConsoleDashboard::ConsoleDashboard(EventManager* eventManager, FILE* output,
+                                   int maxDisplayedLogLines)
+    : eventManager(eventManager), fd(fileno(output)), maxDisplayedLogLines(maxDisplayedLogLines),
+      runningTasksLineCount(0), lastDebugMessageCount(DebugMessage::getMessageCount()) {
+  if (eventManager != nullptr) {
+    frameTimer = newOwned<Timer>(eventManager);
+  }
+  // Anything already buffered must come out before our own writes.
+  fflush(output);
+  lastFrameTime.tv_sec = 0;
+  lastFrameTime.tv_nsec = 0;
+  signal(SIGWINCH, &handleWindowSizeChange);
+}
+
+ConsoleDashboard::~ConsoleDashboard() {
+  signal(SIGWINCH, SIG_DFL);
+  if (frameOp != nullptr) {
+    frameOp.release();
+    drawFrame();
+  }
+}
 
 OwnedPtr<Dashboard::Task> ConsoleDashboard::beginTask(
     const std::string& verb, const std::string& noun, Silence silence) {
   return newOwned<TaskImpl>(this, verb, noun, silence);
 }
 
-void ConsoleDashboard::clearRunning() {
+const struct winsize& ConsoleDashboard::getWindowSize() {
+  if (windowSizeChanged) {
+    windowSizeChanged = 0;
+    ioctl(fd, TIOCGWINSZ, &windowSize);
+  }
+  return windowSize;
+}
+
+void ConsoleDashboard::scheduleFrame() {
+  if (eventManager == nullptr) {
+    drawFrame();
+    return;
+  }
+
+  if (frameOp != nullptr) {
+    // Already scheduled; this change will be drawn with the others.
+    return;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long elapsedMs = (now.tv_sec - lastFrameTime.tv_sec) * 1000 +
+                   (now.tv_nsec - lastFrameTime.tv_nsec) / 1000000;
+
+  // Even if we're allowed to draw right away, wait for the event loop to come around again,
+  // since whatever caused this change is probably about to cause more.
+  long delayMs = std::max(1000 / FRAMES_PER_SECOND - elapsedMs, 0L);
+  frameOp = eventManager->when(frameTimer->after(delayMs))(
+    [this](Void) {
+      frameOp.release();
+      drawFrame();
+    });
+}
+
+void ConsoleDashboard::drawFrame() {
+  std::string frame;
+  clearRunning(&frame);
+  frame.append(pendingLog);
+  pendingLog.clear();
+  drawRunning(&frame);
+
+  const char* pos = frame.data();
+  const char* end = pos + frame.size();
+  while (pos < end) {
+    ssize_t n = write(fd, pos, end - pos);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      // The terminal went away; nothing we can do.
+      break;
+    }
+    pos += n;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &lastFrameTime);
+}
+
+void ConsoleDashboard::clearRunning(std::string* frame) {
   if (lastDebugMessageCount != DebugMessage::getMessageCount()) {
     // Some debug messages were printed.  We don't want to clobber them.  So we can't clear.
     return;
   }
 
   if (runningTasksLineCount > 0) {
-    fprintf(out, ANSI_MOVE_CURSOR_UP, runningTasksLineCount);
-    fputs(ANSI_CLEAR_BELOW_CURSOR, out);
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), ANSI_MOVE_CURSOR_UP, runningTasksLineCount);
+    frame->append(buffer);
+    frame->append(ANSI_CLEAR_BELOW_CURSOR);
   }
 }
 
-void ConsoleDashboard::drawRunning() {
-  struct winsize windowSize;
-  ioctl(fd, TIOCGWINSZ, &windowSize);
+void ConsoleDashboard::drawRunning(std::string* frame) {
+  const struct winsize& windowSize = getWindowSize();
 
   // Leave a few lines for completed tasks.
   int spaceForTasks = windowSize.ws_row - 4;
@@ -359,25 +493,27 @@ void ConsoleDashboard::drawRunning() {
     TaskImpl* task = runningTasks[i];
     int spaceForNoun = windowSize.ws_col - task->verb.size() - 2;
 
-    fprintf(out, "%s↺ %s:%s ", ANSI_COLOR_CODES[RUNNING_COLOR],
-        task->verb.c_str(), ANSI_CLEAR_COLOR);
+    frame->append(ANSI_COLOR_CODES[RUNNING_COLOR]);
+    frame->append("↺ ");
+    frame->append(task->verb);
+    frame->append(":");
+    frame->append(ANSI_CLEAR_COLOR);
+    frame->append(" ");
 
     if (static_cast<int>(task->noun.size()) > spaceForNoun) {
-      std::string shortenedNoun = task->noun.substr(task->noun.size() - spaceForNoun + 3);
-      fprintf(out, "...%s", shortenedNoun.c_str());
+      frame->append("...");
+      frame->append(task->noun, task->noun.size() - spaceForNoun + 3, std::string::npos);
     } else {
-      fputs(task->noun.c_str(), out);
+      frame->append(task->noun);
     }
 
-    putc('\n', out);
+    frame->push_back('\n');
   }
 
   if (!allTasksShown) {
-    fputs("...(more)...\n", out);
+    frame->append("...(more)...\n");
   }
 
-  fflush(out);
-
   lastDebugMessageCount = DebugMessage::getMessageCount();
 }
 
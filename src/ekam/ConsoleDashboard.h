@@ -17,15 +17,21 @@
 #ifndef KENTONSCODE_EKAM_CONSOLEDASHBOARD_H_
 #define KENTONSCODE_EKAM_CONSOLEDASHBOARD_H_
 
+#include <string>
 #include <vector>
+#include <signal.h>
 #include <stdio.h>
+#include <time.h>
+#include <sys/ioctl.h>
 #include "Dashboard.h"
+#include "os/Timer.h"
 
 namespace ekam {
 
 class ConsoleDashboard : public Dashboard {
 public:
-  ConsoleDashboard(FILE* output, int maxDisplayedLogLines);
+  // If eventManager is null, every change is drawn immediately instead of batched into frames.
+  ConsoleDashboard(EventManager* eventManager, FILE* output, int maxDisplayedLogLines);
   ~ConsoleDashboard();
 
   // implements Dashboard ----------------------------------------------------------------
@@ -35,14 +41,31 @@ private:
   class TaskImpl;
   class LogFormatter;
 
+  EventManager* eventManager;
   int fd;
-  FILE* out;
   int maxDisplayedLogLines;
 
+  // Cap on bytes of log kept per displayed line.
+  static const size_t MAX_LINE_BYTES = 1024;
+
   std::vector<TaskImpl*> runningTasks;
   int runningTasksLineCount;
   int lastDebugMessageCount;
 
+  // Changes are drawn in frames, at most FRAMES_PER_SECOND times per second, each written
+  // with a single write().  Logs of completed tasks accumulate in pendingLog until then.
+  static const int FRAMES_PER_SECOND = 20;
+  std::string pendingLog;
+  OwnedPtr<Timer> frameTimer;
+  Promise<void> frameOp;  // null if no frame scheduled
+  struct timespec lastFrameTime;
+
+  // Re-read when we get SIGWINCH.
+  struct winsize windowSize;
+  static volatile sig_atomic_t windowSizeChanged;
+  static void handleWindowSizeChange(int signum);
+  const struct winsize& getWindowSize();
+
   enum Color {
     BLACK,
     RED,
@@ -72,8 +95,10 @@ private:
   static const Color FAILED_COLOR;
   static const Color RUNNING_COLOR;
 
-  void clearRunning();
-  void drawRunning();
+  void scheduleFrame();
+  void drawFrame();
+  void clearRunning(std::string* frame);
+  void drawRunning(std::string* frame);
 };
 
 }  // namespace ekam
@@ -32,10 +32,6 @@ namespace ekam {
 
 namespace {
 
-OwnedPtr<File> getDepsFile(File* objectFile) {
-  return objectFile->parent()->relative(objectFile->basename() + ".deps");
-}
-
 bool isTestName(const std::string& name) {
   std::string::size_type pos = name.find_last_of("_-");
   if (pos == std::string::npos) {
@@ -77,6 +73,10 @@ private:
 
   private:
     OwnedPtrMap<File*, File, File::HashFunc, File::EqualFunc> deps;
+
+    // Symbols already looked up.  Most objects in a binary share many of the same undefined
+    // symbols, so there's no need to resolve each of them over and over.
+    std::unordered_set<Tag, Tag::HashFunc> resolvedSymbols;
   };
 
   static const Tag GTEST_MAIN;
@@ -112,23 +112,18 @@ void LinkAction::DepsSet::addObject(BuildContext* context, File* objectFile) {
   File* rawptr = ptr.get();  // cannot inline due to undefined evaluation order
   deps.add(rawptr, ptr.release());
 
-  OwnedPtr<File> depsFile = getDepsFile(objectFile);
-  if (depsFile->exists()) {
-    std::string data = depsFile->readAll();
-
-    std::string::size_type prevPos = 0;
-    std::string::size_type pos = data.find_first_of('\n');
-
-    while (pos != std::string::npos) {
-      std::string symbolName(data, prevPos, pos - prevPos);
-
-      File* file = context->findProvider(Tag::fromName("c++symbol:" + symbolName));
-      if (file != NULL) {
-        addObject(context, file);
+  // The compile rule writes the object's undefined symbols to a sibling ".deps" file.  The
+  // parsed list is cached by the driver and shared by every link that uses this object.
+  const std::vector<Tag>* symbols =
+      context->findTagList(objectFile->canonicalName() + ".deps", "c++symbol:");
+  if (symbols != NULL) {
+    for (const Tag& symbol: *symbols) {
+      if (resolvedSymbols.insert(symbol).second) {
+        File* file = context->findProvider(symbol);
+        if (file != NULL) {
+          addObject(context, file);
+        }
       }
-
-      prevPos = pos + 1;
-      pos = data.find_first_of('\n', prevPos);
     }
   }
 }
@@ -170,33 +165,61 @@ Promise<void> LinkAction::start(EventManager* eventManager, BuildContext* contex
     base += ".node";
   }
 
-  auto promise = startTarget(eventManager, context, base, flatDeps, "");
+  // The host link plus one per cross target.  These are independent, so if the scheduler has
+  // idle slots to spare, we run them in parallel lanes.
+  std::vector<std::string> targets;
+  targets.push_back("");
+  const char* crossTargets = getenv("CROSS_TARGETS");
+  if (crossTargets != NULL) {
+    while (true) {
+      const char* spacepos = strchr(crossTargets, ' ');
+      std::string target = spacepos == NULL ? crossTargets : std::string(crossTargets, spacepos);
+      if (!target.empty()) targets.push_back(target);
+      if (spacepos == NULL) break;
+      crossTargets = spacepos + 1;
+    }
+  }
 
-  const char* targets = getenv("CROSS_TARGETS");
-  if (targets != NULL) {
-    auto addTarget = [&](std::string target) {
-      OwnedPtrVector<File> targetDeps;
-      for (int i = 0; i < flatDeps.size(); i++) {
-        std::string name, ext;
-        splitExtension(flatDeps.get(i)->basename(), &name, &ext);
-        targetDeps.add(flatDeps.get(i)->parent()->relative(name + '.' + target + ext));
+  // Each cross target's objects are compiled by separate actions (see compile.ekam-rule), so
+  // look them up as dependencies.  If any aren't built yet, we'll be re-run when they are.
+  std::vector<OwnedPtrVector<File> > targetDeps(targets.size());
+  for (size_t i = 1; i < targets.size(); i++) {
+    for (int j = 0; j < flatDeps.size(); j++) {
+      std::string name, ext;
+      splitExtension(flatDeps.get(j)->canonicalName(), &name, &ext);
+      std::string targetName = name + '.' + targets[i] + ext;
+      File* targetObject = context->findProvider(Tag::fromName("canonical:" + targetName));
+      if (targetObject == NULL) {
+        context->log("missing object for target " + targets[i] + ": " + targetName + "\n");
+        context->failed();
+        return newFulfilledPromise();
       }
+      targetDeps[i].add(targetObject->clone());
+    }
+  }
+  flatDeps.swap(&targetDeps[0]);
 
+  int laneCount = 1 + context->acquireSlots(targets.size() - 1);
+
+  Promise<void> result;
+  for (int lane = 0; lane < laneCount; lane++) {
+    Promise<void> promise = newFulfilledPromise();
+    for (size_t i = lane; i < targets.size(); i += laneCount) {
       promise = eventManager->when(std::move(promise))(
-          [this, target = std::move(target), targetDeps = std::move(targetDeps),
+          [this, target = std::move(targets[i]), deps = std::move(targetDeps[i]),
            eventManager, context, base](Void) mutable {
-        return startTarget(eventManager, context, base, targetDeps, target);
+        return startTarget(eventManager, context, base, deps, target);
       });
-    };
+    }
 
-    while (const char* spacepos = strchr(targets, ' ')) {
-      addTarget(std::string(targets, spacepos));
-      targets = spacepos + 1;
+    if (lane == 0) {
+      result = std::move(promise);
+    } else {
+      result = eventManager->when(result, promise)([](Void, Void) {});
     }
-    addTarget(targets);
   }
 
-  return promise;
+  return result;
 }
 
 Promise<void> LinkAction::startTarget(
@@ -269,8 +292,11 @@ Promise<void> LinkAction::startTarget(
   auto logStream = subprocess->captureStdoutAndStderr();
 
   auto subprocessWaitOp = eventManager->when(subprocess->start(eventManager))(
-    [context](ProcessExitCode exitCode) {
+    [context, target](ProcessExitCode exitCode) {
       if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
+        if (!target.empty()) {
+          context->log("link failed for target: " + target + "\n");
+        }
         context->failed();
       }
     });
@@ -325,4 +351,8 @@ OwnedPtr<Action> CppActionFactory::tryMakeAction(const Tag& id, File* file) {
   return nullptr;
 }
 
+std::string CppActionFactory::getIdentity() {
+  return "c++link";
+}
+
 }  // namespace ekam
@@ -31,6 +31,7 @@ public:
   // implements ActionFactory ------------------------------------------------------------
   void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter);
   OwnedPtr<Action> tryMakeAction(const Tag& id, File* file);
+  std::string getIdentity();
 
 private:
   static const Tag MAIN_SYMBOLS[];
@@ -20,5 +20,11 @@ namespace ekam {
 
 Dashboard::~Dashboard() {}
 Dashboard::Task::~Task() {}
+Dashboard::RequestHandler::~RequestHandler() {}
+
+void Dashboard::Task::setResourceUsage(const ResourceUsage& usage) {}
+void Dashboard::Task::setSharedLog(LogStore::Log* log) {}
+
+void Dashboard::setRequestHandler(RequestHandler* handler) {}
 
 }
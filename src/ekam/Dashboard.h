@@ -19,6 +19,8 @@
 
 #include <string>
 #include "base/OwnedPtr.h"
+#include "os/EventManager.h"
+#include "LogStore.h"
 
 namespace ekam {
 
@@ -41,6 +43,15 @@ public:
 
     virtual void setState(TaskState state) = 0;
     virtual void addOutput(const std::string& text) = 0;
+
+    // What the task's processes used.  Reported just before the task finishes, and only if it
+    // ran any processes.  Forgotten when the task goes back to PENDING or RUNNING.
+    virtual void setResourceUsage(const ResourceUsage& usage);
+
+    // Shares a log of everything passed to addOutput(), kept by whoever created this task
+    // (i.e. a MuxDashboard feeding several dashboards), so that a long log is spilled to disk
+    // once rather than by each dashboard.  Called before any output; `log` outlives the task.
+    virtual void setSharedLog(LogStore::Log* log);
   };
 
   enum Silence {
@@ -50,12 +61,24 @@ public:
 
   virtual OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun,
                                    Silence silence) = 0;
-};
 
-class EventManager;
+  // Handles requests made by whoever is watching the dashboard, e.g. an editor.
+  class RequestHandler {
+  public:
+    virtual ~RequestHandler();
+
+    // Get to whatever is built from the given source file (canonical name) ahead of other work.
+    virtual void prioritize(const std::string& name) = 0;
+  };
+
+  // Only dashboards that accept requests (i.e. the network dashboard) do anything with this.
+  // The handler must outlive the dashboard or be unset first.
+  virtual void setRequestHandler(RequestHandler* handler);
+};
 
 OwnedPtr<Dashboard> initNetworkDashboard(EventManager* eventManager, const std::string& address,
-                                         OwnedPtr<Dashboard> dashboardToWrap);
+                                         OwnedPtr<Dashboard> dashboardToWrap,
+                                         LogStore* logStore);
 
 }  // namespace ekam
 
@@ -17,14 +17,18 @@
 #include "Driver.h"
 
 #include <queue>
+#include <algorithm>
 #include <memory>
 #include <stdexcept>
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "base/Debug.h"
+#include "os/DiskFile.h"
 #include "os/EventGroup.h"
+#include "Snapshot.h"
 
 namespace ekam {
 
@@ -50,19 +54,156 @@ int commonPrefixLength(const std::string& srcName, const std::string& bestMatchN
   return n;
 }
 
+std::string stripExtension(const std::string& name) {
+  std::string::size_type pos = name.find_last_of("./");
+  return pos == std::string::npos || name[pos] == '/' ? name : name.substr(0, pos);
+}
+
+// How likely is the file `name` to provide something needed by an action interested in the
+// file `interest`?  Files in the same directory are more likely, and files differing only in
+// extension (e.g. foo.h and foo.cpp) are more likely still.
+int closeness(const std::string& name, const std::string& interest) {
+  std::string::size_type pos = name.rfind('/', commonPrefixLength(name, interest));
+  int directoryLength = pos == std::string::npos ? 0 : pos + 1;
+  return directoryLength * 2 + (stripExtension(name) == stripExtension(interest) ? 1 : 0);
+}
+
+// Tags with more providers than this get a ProviderIndex.
+const int PROVIDER_INDEX_THRESHOLD = 4;
+
+// Records ActionRecords across runs.  See Snapshot.h.
+const char SNAPSHOT_NAME[] = ".ekam-snapshot";
+const char SNAPSHOT_MAGIC[8] = { 'e', 'k', 'a', 'm', 's', 'n', 'p', '2' };
+
 }  // namespace
 
-class Driver::ActionDriver : public BuildContext, public EventGroup::ExceptionHandler {
+// Answers choosePreferredProvider() queries for one tag in O(length of the requesting file's
+// name) rather than O(number of providers).  This is a character trie over the providers'
+// canonical names, where each node remembers the best provider in its subtree by depth and
+// then name.  The providers sharing the longest common prefix with the requesting file are
+// exactly those in the subtree of the deepest trie node reachable by following that file's
+// name, so the answer is simply that node's best provider.
+class Driver::ProviderIndex {
+public:
+  ProviderIndex(const TagTable& tagTable, const Tag& tag) {
+    for (TagTable::SearchIterator<TagTable::TAG> iter(tagTable, tag); iter.next();) {
+      add(iter.cell<TagTable::PROVISION>());
+    }
+  }
+
+  bool empty() { return root.best == nullptr; }
+
+  void add(Provision* provision) {
+    Node* node = &root;
+    node->offer(provision);
+    for (char c: provision->canonicalName) {
+      Node* child = node->children.get(c);
+      if (child == nullptr) {
+        OwnedPtr<Node> newChild = newOwned<Node>();
+        child = newChild.get();
+        node->children.add(c, newChild.release());
+      }
+      node = child;
+      node->offer(provision);
+    }
+    node->provisions.push_back(provision);
+  }
+
+  void remove(Provision* provision) {
+    std::vector<Node*> path;
+    path.push_back(&root);
+    for (char c: provision->canonicalName) {
+      Node* child = path.back()->children.get(c);
+      if (child == nullptr) return;
+      path.push_back(child);
+    }
+
+    std::vector<Provision*>& provisions = path.back()->provisions;
+    auto end = std::remove(provisions.begin(), provisions.end(), provision);
+    if (end == provisions.end()) return;
+    provisions.erase(end, provisions.end());
+
+    for (int i = path.size() - 1; i >= 0; i--) {
+      Node* node = path[i];
+      if (i > 0 && node->provisions.empty() && node->children.empty()) {
+        OwnedPtr<Node> dead;
+        path[i - 1]->children.release(provision->canonicalName[i - 1], &dead);
+      } else {
+        node->recomputeBest();
+      }
+    }
+  }
+
+  Provision* find(const std::string& srcName) {
+    Node* node = &root;
+    for (char c: srcName) {
+      Node* child = node->children.get(c);
+      if (child == nullptr) break;
+      node = child;
+    }
+    return node->best;
+  }
+
+private:
+  struct Node {
+    OwnedPtrMap<char, Node> children;
+    std::vector<Provision*> provisions;  // providers whose names end at this node
+    Provision* best = nullptr;
+
+    void offer(Provision* provision) {
+      if (best == nullptr || isBetter(provision, best)) {
+        best = provision;
+      }
+    }
+
+    void recomputeBest() {
+      best = nullptr;
+      for (Provision* provision: provisions) {
+        offer(provision);
+      }
+      for (OwnedPtrMap<char, Node>::Iterator iter(children); iter.next();) {
+        offer(iter.value()->best);
+      }
+    }
+  };
+
+  Node root;
+
+  static bool isBetter(Provision* a, Provision* b) {
+    // Prefer provider that is less deeply nested, then file that comes first alphabetically.
+    return a->depth < b->depth ||
+        (a->depth == b->depth && a->canonicalName < b->canonicalName);
+  }
+};
+
+class Driver::ActionDriver : public BuildContext, public EventGroup::ExceptionHandler,
+                             public EventGroup::ProcessObserver {
 public:
   ActionDriver(Driver* driver, OwnedPtr<Action> action,
-               File* srcfile, Hash srcHash, OwnedPtr<Dashboard::Task> task);
+               File* srcfile, Hash srcHash);
   ~ActionDriver();
 
   void start();
 
+  // Run an in-process action synchronously, to completion.
+  void runInline();
+
+  // Can this action be completed by replaying the outcome of an identical earlier run?  If
+  // so, replay() does it.
+  bool canReplay();
+
+  // Did the last run of this action (see canReplay()) read something which hasn't been
+  // built yet?  Always false once the action has been released because nothing else was
+  // running.
+  bool awaitsRecordedInputs();
+  void replay();
+
   // implements BuildContext -------------------------------------------------------------
   File* findProvider(Tag id);
   File* findInput(const std::string& path);
+  void noteInput(const std::string& path);
+  const std::vector<Tag>* findTagList(const std::string& canonicalName,
+                                      const std::string& prefix);
 
   void provide(File* file, const std::vector<Tag>& tags);
   void install(File* file, InstallLocation location, const std::string& name);
@@ -71,6 +212,7 @@ public:
   OwnedPtr<File> newOutput(const std::string& path);
 
   void addActionType(OwnedPtr<ActionFactory> factory);
+  int acquireSlots(int count);
 
   void passed();
   void failed();
@@ -80,13 +222,39 @@ public:
   void threwUnknownException();
   void noMoreEvents();
 
+  // implements ProcessObserver ----------------------------------------------------------
+  void processExited(pid_t pid, ProcessExitCode exitCode);
+
 private:
   Driver* driver;
   OwnedPtr<Action> action;
   OwnedPtr<File> srcfile;
+  std::string srcName;
   Hash srcHash;
   OwnedPtr<Dashboard::Task> dashboardTask;
 
+  // Cached from the Action so that the scheduler can consult them cheaply.
+  std::string verb;
+  bool inProcess;
+
+  // Queued in priorityActions rather than pendingActions.  Only changes while not queued.
+  bool prioritized = false;
+
+  // Whether this action leads to a target (see Driver::addTarget()).  An action that doesn't
+  // is deferred -- left in deferredActions -- until something it might provide is needed.
+  bool wanted = true;
+  bool deferred = false;
+  int resetRound = 0;  // value of driver->resetRound when last reset
+
+  // Set by awaitsRecordedInputs() to the recorded input it found missing, so that later calls
+  // needn't look at the other inputs again until that one has a provider.
+  bool awaitingInput = false;
+  Tag awaitedInput;
+
+  // Cleared when the action is released from awaitingActions for lack of anything else to do.
+  // It must then run even though something else has since started.
+  bool mayAwait = true;
+
   // TODO:  Get rid of "state".  Maybe replace with "status" or something, but don't try to
   //   track both whether we're running and what the status was at the same time.  (I already
   //   had to split isRunning into a separate boolean due to issues with this.)
@@ -105,6 +273,26 @@ private:
   bool isRunning;
   Promise<void> runningAction;
 
+  int extraSlots = 0;  // granted by acquireSlots()
+
+  bool replayed = false;  // completed by replay() rather than running
+
+  // Paths passed to noteInput() by the current run.
+  std::set<std::string> externalInputs;
+
+  // Processes the current run has waited for.
+  std::vector<std::pair<pid_t, ProcessExitCode> > exitedProcesses;
+
+  // Set when the action reported its result while its process was still running.  The done
+  // callback waits for the process to exit, so that its resource usage is known.
+  bool awaitingExit = false;
+
+  // For Driver::trace.  The track is Trace::EVENT_LOOP_TRACK for actions that don't run in the
+  // background (in-process or replayed), else one acquired for the run.
+  uint64_t queuedTime = 0;
+  uint64_t startTime = 0;
+  int traceTrack = -1;
+
   OwnedPtrVector<File> outputs;
 
   struct Installation {
@@ -118,14 +306,33 @@ private:
   OwnedPtrVector<std::vector<Tag> > providedTags;
   OwnedPtrVector<ActionFactory> providedFactories;
 
+  // Transitive closure of the actions whose outputs this action consumed (including the one
+  // that triggered it), plus the action itself.  Computed lazily, and only once the action
+  // has finished, since that's the only time its inputs are fixed.  Dropped by reset(), which
+  // necessarily also resets every action whose closure includes this one.
+  bool ancestorsCached = false;
+  std::unordered_set<ActionDriver*> ancestors;
+
   // True if returned() is currently on the stack.  Causes destructor to abort.  Used for
   // debugging.
   bool currentlyExecutingReturned = false;
 
   void ensureRunning();
+  Dashboard::Task* getDashboardTask();
   void queueDoneCallback();
+  void queueResultCallback();  // for passed() and failed()
+  void releaseSlots();
   void returned();
+  void recordOutcome();
   void reset();
+  ResourceUsage processUsage();
+  void traceStart(int track);
+  void traceEnd(const char* outcome);
+  std::string recordKey();
+  ActionRecord* findRecord();
+  std::string getFactoryIdentity();
+  OwnedPtr<File> getRecordedOutput(const ActionRecord::Output& output);
+  const std::unordered_set<ActionDriver*>& getAncestors();
   Provision* choosePreferredProvider(const Tag& tag);
   File* provideInternal(File* file, const std::vector<Tag>& tags);
 
@@ -133,11 +340,14 @@ private:
 };
 
 Driver::ActionDriver::ActionDriver(Driver* driver, OwnedPtr<Action> action,
-                                   File* srcfile, Hash srcHash,
-                                   OwnedPtr<Dashboard::Task> task)
-    : driver(driver), action(action.release()), srcfile(srcfile->clone()), srcHash(srcHash),
-      dashboardTask(task.release()), state(PENDING), eventGroup(driver->eventManager, this),
-      isRunning(false) {}
+                                   File* srcfile, Hash srcHash)
+    : driver(driver), action(action.release()), srcfile(srcfile->clone()),
+      srcName(this->srcfile->canonicalName()), srcHash(srcHash),
+      verb(this->action->getVerb()),
+      inProcess(this->action->isInProcess()), state(PENDING),
+      eventGroup(driver->eventManager, this, this), isRunning(false) {
+  if (driver->trace != nullptr) queuedTime = driver->trace->now();
+}
 Driver::ActionDriver::~ActionDriver() {
   assert(!currentlyExecutingReturned);
 }
@@ -153,7 +363,9 @@ void Driver::ActionDriver::start() {
 
   state = RUNNING;
   isRunning = true;
-  dashboardTask->setState(Dashboard::RUNNING);
+  getDashboardTask()->setState(Dashboard::RUNNING);
+  ++driver->counters.actionsStarted;
+  if (driver->trace != nullptr) traceStart(driver->trace->acquireTrack());
 
   asyncCallbackOp = eventGroup.when()(
     [this]() {
@@ -162,10 +374,147 @@ void Driver::ActionDriver::start() {
     });
 }
 
+void Driver::ActionDriver::runInline() {
+  assert(state == PENDING);
+  assert(inProcess);
+  assert(!isRunning);
+
+  state = RUNNING;
+  isRunning = true;
+  ++driver->counters.actionsRunInline;
+  if (driver->trace != nullptr) traceStart(Trace::EVENT_LOOP_TRACK);
+
+  try {
+    runningAction = action->start(&eventGroup, this);
+  } catch (const std::exception& e) {
+    threwException(e);
+    return;
+  } catch (...) {
+    threwUnknownException();
+    return;
+  }
+
+  if (state == RUNNING) {
+    state = DONE;
+  }
+  returned();
+}
+
+bool Driver::ActionDriver::canReplay() {
+  if (inProcess) {
+    // Not worth it.
+    return false;
+  }
+
+  ActionRecord* record = findRecord();
+  if (record == nullptr) {
+    return false;
+  }
+
+  for (const auto& input: record->inputs) {
+    Provision* provision = choosePreferredProvider(input.first);
+    if ((provision == nullptr ? Hash::NULL_HASH : provision->contentHash) != input.second) {
+      return false;
+    }
+  }
+
+  // E.g. system headers and the compiler's own helpers, which may have been upgraded.
+  for (const auto& input: record->externalInputs) {
+    if (driver->externalFileHash(input.first) != input.second) {
+      return false;
+    }
+  }
+
+  // The outputs are still on disk from the last run, unless someone has touched them.
+  for (const ActionRecord::Output& output: record->outputs) {
+    OwnedPtr<File> file = getRecordedOutput(output);
+    if (!file->exists() || file->contentHash() != output.contentHash) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Driver::ActionDriver::awaitsRecordedInputs() {
+  if (!mayAwait) {
+    return false;
+  } else if (awaitingInput && choosePreferredProvider(awaitedInput) == nullptr) {
+    return true;
+  }
+  awaitingInput = false;
+
+  ActionRecord* record = inProcess ? nullptr : findRecord();
+  if (record == nullptr) {
+    return false;
+  }
+
+  for (const auto& input: record->inputs) {
+    if (input.second != Hash::NULL_HASH && choosePreferredProvider(input.first) == nullptr) {
+      awaitingInput = true;
+      awaitedInput = input.first;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Driver::ActionDriver::replay() {
+  assert(state == PENDING);
+  assert(!isRunning);
+
+  ActionRecord* record = findRecord();
+
+  state = RUNNING;
+  isRunning = true;
+  replayed = true;
+  ++driver->counters.actionsReplayed;
+  if (driver->trace != nullptr) traceStart(Trace::EVENT_LOOP_TRACK);
+
+  if (dashboardTask != nullptr) {
+    // A previous attempt was blocked.  Clear its log, as start() would.
+    dashboardTask->setState(Dashboard::RUNNING);
+  }
+
+  // Depend on exactly what the original run depended on, so that we're reset the same way.
+  for (const auto& input: record->inputs) {
+    driver->dependencyTable.add(input.first, this, choosePreferredProvider(input.first));
+  }
+
+  std::vector<File*> providedFiles;
+  for (const ActionRecord::Output& output: record->outputs) {
+    OwnedPtr<File> file = getRecordedOutput(output);
+    providedFiles.push_back(provideInternal(file.get(), output.tags));
+    if (!output.isSource) {
+      outputs.add(file.release());
+    }
+  }
+  for (const ActionRecord::Installation& installation: record->installations) {
+    // The install tag is among the output's recorded tags, so we don't call install().
+    Installation copy = { providedFiles[installation.output], installation.location,
+                          installation.name };
+    installations.push_back(copy);
+  }
+
+  if (record->passed) {
+    getDashboardTask()->addOutput("(cached: passed previously with identical inputs)\n");
+    state = PASSED;
+  } else {
+    state = DONE;
+  }
+  returned();
+}
+
 File* Driver::ActionDriver::findProvider(Tag tag) {
   ensureRunning();
+  ++driver->counters.providerLookups;
 
+  uint64_t lookupStart = driver->trace == nullptr ? 0 : driver->trace->now();
   Provision* provision = choosePreferredProvider(tag);
+  if (driver->trace != nullptr) {
+    driver->trace->complete(traceTrack, "lookup", "findProvider", lookupStart,
+        Trace::Args().add("provider", provision == NULL ? "(none)" : provision->canonicalName));
+  }
 
   if (provision == NULL) {
     driver->dependencyTable.add(tag, this, NULL);
@@ -182,6 +531,45 @@ File* Driver::ActionDriver::findInput(const std::string& path) {
   return findProvider(Tag::fromFile(path));
 }
 
+void Driver::ActionDriver::noteInput(const std::string& path) {
+  ensureRunning();
+
+  externalInputs.insert(path);
+}
+
+const std::vector<Tag>* Driver::ActionDriver::findTagList(const std::string& canonicalName,
+                                                          const std::string& prefix) {
+  ensureRunning();
+
+  Tag tag = Tag::fromName("canonical:" + canonicalName);
+  Provision* provision = choosePreferredProvider(tag);
+  driver->dependencyTable.add(tag, this, provision);
+
+  if (provision == NULL) {
+    return NULL;
+  }
+
+  // The cache lives in the provision, so it goes away along with the provision when the file
+  // changes.
+  if (provision->tagList == NULL || provision->tagListPrefix != prefix) {
+    std::string data = provision->file->readAll();
+    OwnedPtr<std::vector<Tag> > tags = newOwned<std::vector<Tag> >();
+
+    std::string::size_type prevPos = 0;
+    std::string::size_type pos = data.find_first_of('\n');
+    while (pos != std::string::npos) {
+      tags->push_back(Tag::fromName(prefix + std::string(data, prevPos, pos - prevPos)));
+      prevPos = pos + 1;
+      pos = data.find_first_of('\n', prevPos);
+    }
+
+    provision->tagListPrefix = prefix;
+    provision->tagList = tags.release();
+  }
+
+  return provision->tagList.get();
+}
+
 void Driver::ActionDriver::provide(File* file, const std::vector<Tag>& tags) {
   provideInternal(file, tags);
 }
@@ -228,7 +616,7 @@ void Driver::ActionDriver::install(File* file, InstallLocation location, const s
 
 void Driver::ActionDriver::log(const std::string& text) {
   ensureRunning();
-  dashboardTask->addOutput(text);
+  getDashboardTask()->addOutput(text);
 }
 
 OwnedPtr<File> Driver::ActionDriver::newOutput(const std::string& path) {
@@ -253,15 +641,111 @@ void Driver::ActionDriver::addActionType(OwnedPtr<ActionFactory> factory) {
   providedFactories.add(factory.release());
 }
 
+int Driver::ActionDriver::acquireSlots(int count) {
+  ensureRunning();
+
+  int available = driver->maxConcurrentActions - driver->activeActions.size() -
+                  driver->extraSlots;
+
+  auto limit = driver->verbLimits.find(verb);
+  if (limit != driver->verbLimits.end()) {
+    available = std::min(available, limit->second - driver->countRunningVerbs()[verb]);
+  }
+
+  int granted = 0;
+  while (granted < std::min(count, available) &&
+         driver->tryTakeJobserverToken(
+             driver->activeActions.size() + driver->extraSlots + granted)) {
+    ++granted;
+  }
+  extraSlots += granted;
+  driver->extraSlots += granted;
+  return granted;
+}
+
+void Driver::ActionDriver::releaseSlots() {
+  driver->extraSlots -= extraSlots;
+  extraSlots = 0;
+}
+
 void Driver::ActionDriver::noMoreEvents() {
   if (isRunning) {
     if (state == RUNNING) {
       state = DONE;
       queueDoneCallback();
+    } else if (awaitingExit) {
+      awaitingExit = false;
+      queueDoneCallback();
     }
   }
 }
 
+void Driver::ActionDriver::processExited(pid_t pid, ProcessExitCode exitCode) {
+  exitedProcesses.push_back(std::make_pair(pid, exitCode));
+
+  if (awaitingExit) {
+    // Don't wait for noMoreEvents() too:  the process may have left children behind which
+    // hold its output open.  returned() will cancel whatever is left, as usual.
+    awaitingExit = false;
+    queueDoneCallback();
+  }
+}
+
+ResourceUsage Driver::ActionDriver::processUsage() {
+  ResourceUsage result;
+  for (auto& process: exitedProcesses) {
+    result.add(process.second.getResourceUsage());
+  }
+  return result;
+}
+
+void Driver::ActionDriver::traceStart(int track) {
+  traceTrack = track;
+  startTime = driver->trace->now();
+  if (track != Trace::EVENT_LOOP_TRACK) {
+    driver->trace->span("queue", "queued", queuedTime, startTime,
+        Trace::Args().add("verb", verb).add("noun", srcName));
+  }
+}
+
+void Driver::ActionDriver::traceEnd(const char* outcome) {
+  Trace::Args args;
+  args.add("verb", verb).add("noun", srcName).add("outcome", outcome);
+  if (replayed) {
+    args.add("cached", 1);
+  }
+  if (traceTrack != Trace::EVENT_LOOP_TRACK) {
+    args.add("slot", traceTrack);
+  }
+  if (!exitedProcesses.empty()) {
+    std::string pids;
+    std::string statuses;
+    for (auto& process: exitedProcesses) {
+      if (!pids.empty()) {
+        pids += " ";
+        statuses += " ";
+      }
+      pids += std::to_string(process.first);
+      if (process.second.wasSignaled()) {
+        statuses += "signal " + std::to_string(process.second.getSignalNumber());
+      } else {
+        statuses += std::to_string(process.second.getExitCode());
+      }
+    }
+    ResourceUsage usage = processUsage();
+    args.add("pid", pids).add("exit", statuses)
+        .add("userMicros", usage.userMicros).add("systemMicros", usage.systemMicros)
+        .add("maxRssKb", usage.maxRssKb);
+  }
+
+  driver->trace->complete(traceTrack, inProcess ? "inline" : "action", verb + ": " + srcName,
+                          startTime, args);
+  if (traceTrack != Trace::EVENT_LOOP_TRACK) {
+    driver->trace->releaseTrack(traceTrack);
+  }
+  traceTrack = -1;
+}
+
 void Driver::ActionDriver::passed() {
   ensureRunning();
 
@@ -271,7 +755,7 @@ void Driver::ActionDriver::passed() {
   }
 
   state = PASSED;
-  queueDoneCallback();
+  queueResultCallback();
 }
 
 void Driver::ActionDriver::failed() {
@@ -288,7 +772,7 @@ void Driver::ActionDriver::failed() {
     throw std::runtime_error("Called failed() after passed().");
   } else {
     state = FAILED;
-    queueDoneCallback();
+    queueResultCallback();
   }
 }
 
@@ -298,7 +782,29 @@ void Driver::ActionDriver::ensureRunning() {
   }
 }
 
+Dashboard::Task* Driver::ActionDriver::getDashboardTask() {
+  // In-process actions don't get a task until they have something to report, since the vast
+  // majority of them finish instantly and silently.  Others get one as soon as they're queued
+  // (or released, if deferred).
+  if (dashboardTask == nullptr) {
+    std::string noun = srcName;
+    std::string variant = action->getVariant();
+    if (!variant.empty()) {
+      noun += " (" + variant + ")";
+    }
+
+    dashboardTask = driver->dashboard->beginTask(
+        verb, noun, action->isSilent() ? Dashboard::SILENT : Dashboard::NORMAL);
+  }
+  return dashboardTask.get();
+}
+
 void Driver::ActionDriver::queueDoneCallback() {
+  if (inProcess) {
+    // runInline() will call returned() as soon as start() returns.
+    return;
+  }
+
   asyncCallbackOp = driver->eventManager->when()(
     [this]() {
       asyncCallbackOp.release();
@@ -308,9 +814,19 @@ void Driver::ActionDriver::queueDoneCallback() {
     });
 }
 
+void Driver::ActionDriver::queueResultCallback() {
+  if (!inProcess && eventGroup.hasPendingEvents()) {
+    // Typically a test reporting that it passed just before it exits.  Wait for that, rather
+    // than kill it, so that its resource usage is counted.
+    awaitingExit = true;
+  } else {
+    queueDoneCallback();
+  }
+}
+
 void Driver::ActionDriver::threwException(const std::exception& e) {
   ensureRunning();
-  dashboardTask->addOutput(std::string("uncaught exception: ") + e.what() + "\n");
+  getDashboardTask()->addOutput(std::string("uncaught exception: ") + e.what() + "\n");
   asyncCallbackOp.release();
   state = FAILED;
   returned();
@@ -318,7 +834,7 @@ void Driver::ActionDriver::threwException(const std::exception& e) {
 
 void Driver::ActionDriver::threwUnknownException() {
   ensureRunning();
-  dashboardTask->addOutput("uncaught exception of unknown type\n");
+  getDashboardTask()->addOutput("uncaught exception of unknown type\n");
   asyncCallbackOp.release();
   state = FAILED;
   returned();
@@ -330,8 +846,32 @@ void Driver::ActionDriver::returned() {
   currentlyExecutingReturned = true;
 
   // Cancel anything still running.
+  awaitingExit = false;
   runningAction.release();
   isRunning = false;
+  releaseSlots();
+  if (driver->trace != nullptr) {
+    traceEnd(state == FAILED ? "failed" : state == PASSED ? "passed" : "done");
+  }
+  if (state == FAILED) {
+    ++driver->counters.actionsFailed;
+  } else if (state == PASSED) {
+    ++driver->counters.actionsPassed;
+  } else {
+    ++driver->counters.actionsDone;
+  }
+
+  if (!exitedProcesses.empty()) {
+    ResourceUsage usage = processUsage();
+    getDashboardTask()->setResourceUsage(usage);
+
+    VerbUsage& verbUsage = driver->verbUsage[verb];
+    if (verbUsage.actions == 0 || usage.maxRssKb > verbUsage.total.maxRssKb) {
+      verbUsage.largestNoun = srcName;
+    }
+    ++verbUsage.actions;
+    verbUsage.total.add(usage);
+  }
 
   // Pull self out of driver->activeActions.
   OwnedPtr<ActionDriver> self;
@@ -345,15 +885,18 @@ void Driver::ActionDriver::returned() {
   driver->completedActionPtrs.add(this, self.release());
 
   if (state == FAILED) {
-    // Failed, possibly due to missing dependencies.
+    // Failed, possibly due to missing dependencies.  Any record of an earlier success is left
+    // alone:  it is only replayed if the inputs go back to what they were then.
     provisions.clear();
     installations.clear();
     providedTags.clear();
     providedFactories.clear();
     outputs.clear();
-    dashboardTask->setState(Dashboard::BLOCKED);
+    getDashboardTask()->setState(Dashboard::BLOCKED);
   } else {
-    dashboardTask->setState(state == PASSED ? Dashboard::PASSED : Dashboard::DONE);
+    if (dashboardTask != nullptr) {
+      dashboardTask->setState(state == PASSED ? Dashboard::PASSED : Dashboard::DONE);
+    }
 
     // Remove outputs which were deleted before the action completed.  Some actions create
     // files and then delete them immediately.
@@ -365,11 +908,13 @@ void Driver::ActionDriver::returned() {
       }
     }
 
-    // Register providers.  But, don't allow our own dependencies to depend on them.
-    std::unordered_set<ActionDriver*> deps;
-    driver->getTransitiveDependencies(this, &deps);
+    // Register providers.  registerProvider() won't allow our own dependencies to depend on
+    // them.
     for (int i = 0; i < provisions.size(); i++) {
-      driver->registerProvider(provisions.get(i), *providedTags.get(i), deps);
+      driver->registerProvider(provisions.get(i), *providedTags.get(i));
+    }
+    if (!replayed) {
+      recordOutcome();
     }
     providedTags.clear();  // Not needed anymore.
 
@@ -400,6 +945,92 @@ void Driver::ActionDriver::returned() {
   currentlyExecutingReturned = false;
 }
 
+void Driver::ActionDriver::recordOutcome() {
+  if (inProcess || !providedFactories.empty()) {
+    // Nothing to gain, or not replayable.
+    return;
+  }
+
+  OwnedPtr<ActionRecord> record = newOwned<ActionRecord>();
+  record->factory = getFactoryIdentity();
+  if (record->factory.empty()) {
+    return;
+  }
+  record->srcHash = srcHash;
+  record->passed = state == PASSED;
+
+  for (DependencyTable::SearchIterator<DependencyTable::ACTION>
+       iter(driver->dependencyTable, this); iter.next();) {
+    Provision* provision = iter.cell<DependencyTable::PROVISION>();
+    record->inputs.push_back(std::make_pair(
+        iter.cell<DependencyTable::TAG>(),
+        provision == nullptr ? Hash::NULL_HASH : provision->contentHash));
+  }
+
+  for (const std::string& path: externalInputs) {
+    record->externalInputs.push_back(std::make_pair(path, driver->externalFileHash(path)));
+  }
+
+  for (int i = 0; i < provisions.size(); i++) {
+    File* file = provisions.get(i)->file.get();
+
+    ActionRecord::Output output;
+    output.isSource = file->equals(srcfile.get());
+    if (!output.isSource) {
+      // We can only find it again next time if it's in tmp.
+      output.name = file->canonicalName();
+      if (!driver->tmp->relative(output.name)->equals(file)) {
+        return;
+      }
+    }
+    output.contentHash = provisions.get(i)->contentHash;
+    output.tags = *providedTags.get(i);
+    record->outputs.push_back(std::move(output));
+  }
+
+  for (const Installation& installation: installations) {
+    ActionRecord::Installation recorded = { -1, installation.location, installation.name };
+    for (int i = 0; i < provisions.size(); i++) {
+      if (provisions.get(i)->file.get() == installation.file) {
+        recorded.output = i;
+      }
+    }
+    if (recorded.output < 0) {
+      return;
+    }
+    record->installations.push_back(recorded);
+  }
+
+  driver->actionRecords.add(recordKey(), record.release());
+  driver->actionRecordsChanged = true;
+}
+
+std::string Driver::ActionDriver::recordKey() {
+  return verb + ':' + srcName + ':' + action->getVariant();
+}
+
+Driver::ActionRecord* Driver::ActionDriver::findRecord() {
+  if (driver->replayDisabled) {
+    return nullptr;
+  }
+  ActionRecord* record = driver->actionRecords.get(recordKey());
+  if (record == nullptr || record->srcHash != srcHash || record->factory != getFactoryIdentity()) {
+    return nullptr;
+  }
+  return record;
+}
+
+std::string Driver::ActionDriver::getFactoryIdentity() {
+  const ActionTriggersTable::Row* trigger =
+      driver->actionTriggersTable.find<ActionTriggersTable::ACTION>(this);
+  return trigger == nullptr ? std::string() :
+      trigger->cell<ActionTriggersTable::FACTORY>()->getIdentity();
+}
+
+OwnedPtr<File> Driver::ActionDriver::getRecordedOutput(const ActionRecord::Output& output) {
+  return output.isSource ? srcfile->clone() : driver->tmp->relative(output.name);
+}
+
 void Driver::ActionDriver::reset() {
   assert(!currentlyExecutingReturned);
 
@@ -409,11 +1040,16 @@ void Driver::ActionDriver::reset() {
   }
 
   OwnedPtr<ActionDriver> self;
+  ++driver->counters.actionsReset;
 
   if (isRunning) {
-    dashboardTask->setState(Dashboard::BLOCKED);
+    ++driver->counters.actionsCancelled;
+    if (dashboardTask != nullptr) dashboardTask->setState(Dashboard::BLOCKED);
+    awaitingExit = false;
     runningAction.release();
     asyncCallbackOp.release();
+    releaseSlots();
+    if (driver->trace != nullptr) traceEnd("cancelled");
 
     for (int i = 0; i < driver->activeActions.size(); i++) {
       if (driver->activeActions.get(i) == this) {
@@ -427,7 +1063,15 @@ void Driver::ActionDriver::reset() {
     if (!driver->completedActionPtrs.release(this, &self)) {
       throw std::logic_error("Action not running or pending, but not in completedActionPtrs?");
     }
+    if (driver->trace != nullptr) {
+      driver->trace->instant(Trace::EVENT_LOOP_TRACK, "action", "reset " + verb + ": " + srcName);
+    }
   }
+  if (driver->trace != nullptr) queuedTime = driver->trace->now();
+
+  // Actions that failed last time are probably what the user is working on.
+  prioritized = driver->prioritizing || state == FAILED;
+  resetRound = driver->resetRound;
 
   state = PENDING;
 
@@ -438,7 +1082,7 @@ void Driver::ActionDriver::reset() {
   //   action queue should really be a graph that remembers what depended on what the last
   //   time we ran them, and avoids re-running any action before re-running actions on which it
   //   depended last time.
-  driver->pendingActions.pushBack(self.release());
+  driver->queueFor(this).pushBack(self.release());
 
   // Reset dependents.
   for (int i = 0; i < provisions.size(); i++) {
@@ -458,16 +1102,7 @@ void Driver::ActionDriver::reset() {
 
     for (size_t j = 0; j < actionsToDelete.size(); j++) {
       actionsToDelete[j]->reset();
-
-      // TODO:  Use better data structure for pendingActions.  For now we have to iterate
-      //   through the whole thing to find the action we're deleting.  We iterate from the back
-      //   since it's likely the action was just added there.
-      for (int k = driver->pendingActions.size() - 1; k >= 0; k--) {
-        if (driver->pendingActions.get(k) == actionsToDelete[j]) {
-          driver->pendingActions.releaseAndShift(k);
-          break;
-        }
-      }
+      driver->deletePendingAction(actionsToDelete[j]);
     }
 
     driver->actionTriggersTable.erase<ActionTriggersTable::FACTORY>(factory);
@@ -477,6 +1112,14 @@ void Driver::ActionDriver::reset() {
   // Remove all entries in dependencyTable pointing at this action.
   driver->dependencyTable.erase<DependencyTable::ACTION>(this);
 
+  ancestorsCached = false;
+  ancestors.clear();
+  replayed = false;
+  awaitingInput = false;
+  mayAwait = true;
+  exitedProcesses.clear();
+  externalInputs.clear();
+
   provisions.clear();
   installations.clear();
   providedTags.clear();
@@ -484,36 +1127,71 @@ void Driver::ActionDriver::reset() {
   outputs.clear();
 }
 
+const std::unordered_set<Driver::ActionDriver*>& Driver::ActionDriver::getAncestors() {
+  if (!ancestorsCached) {
+    // Our direct parents are all finished, so their own sets can be cached and reused by every
+    // action downstream of them.
+    std::unordered_set<ActionDriver*> result;
+    result.insert(this);
+
+    for (ActionTriggersTable::SearchIterator<ActionTriggersTable::ACTION>
+         iter(driver->actionTriggersTable, this); iter.next();) {
+      ActionDriver* parent = iter.cell<ActionTriggersTable::PROVISION>()->creator;
+      if (parent != nullptr) {
+        const std::unordered_set<ActionDriver*>& parentAncestors = parent->getAncestors();
+        result.insert(parentAncestors.begin(), parentAncestors.end());
+      }
+    }
+    for (DependencyTable::SearchIterator<DependencyTable::ACTION>
+         iter(driver->dependencyTable, this); iter.next();) {
+      Provision* provision = iter.cell<DependencyTable::PROVISION>();
+      if (provision != nullptr && provision->creator != nullptr &&
+          result.count(provision->creator) == 0) {
+        const std::unordered_set<ActionDriver*>& parentAncestors =
+            provision->creator->getAncestors();
+        result.insert(parentAncestors.begin(), parentAncestors.end());
+      }
+    }
+
+    ancestors.swap(result);
+    ancestorsCached = true;
+  }
+
+  return ancestors;
+}
+
 Driver::Provision* Driver::ActionDriver::choosePreferredProvider(const Tag& tag) {
+  ProviderIndex* index = driver->providerIndexes.get(tag);
+  if (index != nullptr) {
+    return index->find(srcName);
+  }
+
   TagTable::SearchIterator<TagTable::TAG> iter(driver->tagTable, tag);
 
   if (!iter.next()) {
     return NULL;
   } else {
-    std::string srcName = srcfile->canonicalName();
     Provision* bestMatch = iter.cell<TagTable::PROVISION>();
+    int providerCount = 1;
 
     if (iter.next()) {
       // There are multiple files with this tag.  We must choose which one we like best.
-      std::string bestMatchName = bestMatch->file->canonicalName();
-      int bestMatchDepth = fileDepth(bestMatchName);
-      int bestMatchCommonPrefix = commonPrefixLength(srcName, bestMatchName);
+      int bestMatchCommonPrefix = commonPrefixLength(srcName, bestMatch->canonicalName);
 
       do {
+        ++providerCount;
         Provision* candidate = iter.cell<TagTable::PROVISION>();
-        std::string candidateName = candidate->file->canonicalName();
-        int candidateDepth = fileDepth(candidateName);
-        int candidateCommonPrefix = commonPrefixLength(srcName, candidateName);
+        int candidateCommonPrefix = commonPrefixLength(srcName, candidate->canonicalName);
         if (candidateCommonPrefix < bestMatchCommonPrefix) {
           // Prefer provider that is closer in the directory tree.
           continue;
         } else if (candidateCommonPrefix == bestMatchCommonPrefix) {
-          if (candidateDepth > bestMatchDepth) {
+          if (candidate->depth > bestMatch->depth) {
             // Prefer provider that is less deeply nested.
             continue;
-          } else if (candidateDepth == bestMatchDepth) {
+          } else if (candidate->depth == bestMatch->depth) {
             // Arbitrarily -- but consistently -- choose one.
-            int diff = bestMatchName.compare(candidateName);
+            int diff = bestMatch->canonicalName.compare(candidate->canonicalName);
             if (diff < 0) {
               // Prefer file that comes first alphabetically.
               continue;
@@ -521,7 +1199,7 @@ Driver::Provision* Driver::ActionDriver::choosePreferredProvider(const Tag& tag)
               // TODO:  Is this really an error?  I think it is for the moment, but someday it
               //   may not be, if multiple actions are allowed to produce outputs with the same
               //   canonical names.
-              DEBUG_ERROR << "Two providers have same file name: " << bestMatchName;
+              DEBUG_ERROR << "Two providers have same file name: " << bestMatch->canonicalName;
               continue;
             }
           }
@@ -529,12 +1207,17 @@ Driver::Provision* Driver::ActionDriver::choosePreferredProvider(const Tag& tag)
 
         // If we get here, the candidate is better than the existing best match.
         bestMatch = candidate;
-        bestMatchName.swap(candidateName);
-        bestMatchDepth = candidateDepth;
         bestMatchCommonPrefix = candidateCommonPrefix;
       } while(iter.next());
     }
 
+    if (providerCount > PROVIDER_INDEX_THRESHOLD) {
+      // This tag is popular.  Index it so that future lookups don't have to scan every
+      // provider.  Indexes are kept up-to-date by registerProvider() and
+      // resetDependentActions().
+      driver->providerIndexes.add(tag, newOwned<ProviderIndex>(driver->tagTable, tag));
+    }
+
     return bestMatch;
   }
 }
@@ -553,9 +1236,152 @@ Driver::Driver(EventManager* eventManager, Dashboard* dashboard, File* tmp,
   for (int i = 0; i < BuildContext::INSTALL_LOCATION_COUNT; i++) {
     this->installDirs[i] = installDirs[i];
   }
+
+  loadSnapshot();
+  dashboard->setRequestHandler(this);
 }
 
-Driver::~Driver() {}
+Driver::~Driver() {
+  dashboard->setRequestHandler(nullptr);
+  if (actionRecordsChanged) {
+    saveSnapshot();
+  }
+}
+
+void Driver::loadSnapshot() {
+  SnapshotReader reader(tmp->relative(SNAPSHOT_NAME).get(), SNAPSHOT_MAGIC);
+  while (reader.ok && !reader.atEnd()) {
+    std::string key = reader.readString();
+    OwnedPtr<ActionRecord> record = newOwned<ActionRecord>();
+    record->factory = reader.readString();
+    record->srcHash = reader.readHash();
+    record->passed = reader.readInt() != 0;
+
+    uint32_t count = reader.readCount(Hash::SIZE * 2);
+    for (uint32_t i = 0; i < count; i++) {
+      Tag tag = Tag::fromHash(reader.readHash());
+      record->inputs.push_back(std::make_pair(tag, reader.readHash()));
+    }
+
+    count = reader.readCount(sizeof(uint32_t) + Hash::SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+      std::string path = reader.readString();
+      record->externalInputs.push_back(std::make_pair(path, reader.readHash()));
+    }
+
+    count = reader.readCount(Hash::SIZE);
+    record->outputs.resize(count);
+    for (ActionRecord::Output& output: record->outputs) {
+      output.isSource = reader.readInt() != 0;
+      output.name = reader.readString();
+      output.contentHash = reader.readHash();
+      uint32_t tagCount = reader.readCount(Hash::SIZE);
+      for (uint32_t i = 0; i < tagCount; i++) {
+        output.tags.push_back(Tag::fromHash(reader.readHash()));
+      }
+    }
+
+    count = reader.readCount(sizeof(uint32_t) * 3);
+    for (uint32_t i = 0; i < count; i++) {
+      ActionRecord::Installation installation;
+      installation.output = reader.readInt();
+      installation.location = static_cast<BuildContext::InstallLocation>(reader.readInt());
+      installation.name = reader.readString();
+      if (installation.output >= static_cast<int>(record->outputs.size()) ||
+          installation.location >= BuildContext::INSTALL_LOCATION_COUNT) {
+        reader.ok = false;
+      }
+      record->installations.push_back(installation);
+    }
+
+    if (reader.ok) {
+      actionRecords.add(key, record.release());
+    }
+  }
+
+  if (!reader.ok) {
+    // Missing, stale, or corrupt.  Start over.
+    actionRecords.clear();
+    actionRecordsChanged = true;
+  }
+}
+
+void Driver::saveSnapshot() {
+  SnapshotWriter writer(SNAPSHOT_MAGIC);
+
+  for (OwnedPtrMap<std::string, ActionRecord>::Iterator iter(actionRecords); iter.next();) {
+    const ActionRecord* record = iter.value();
+    writer.writeString(iter.key());
+    writer.writeString(record->factory);
+    writer.writeHash(record->srcHash);
+    writer.writeInt(record->passed);
+
+    writer.writeInt(record->inputs.size());
+    for (const auto& input: record->inputs) {
+      writer.writeHash(input.first.getHash());
+      writer.writeHash(input.second);
+    }
+
+    writer.writeInt(record->externalInputs.size());
+    for (const auto& input: record->externalInputs) {
+      writer.writeString(input.first);
+      writer.writeHash(input.second);
+    }
+
+    writer.writeInt(record->outputs.size());
+    for (const ActionRecord::Output& output: record->outputs) {
+      writer.writeInt(output.isSource);
+      writer.writeString(output.name);
+      writer.writeHash(output.contentHash);
+      writer.writeInt(output.tags.size());
+      for (const Tag& tag: output.tags) {
+        writer.writeHash(tag.getHash());
+      }
+    }
+
+    writer.writeInt(record->installations.size());
+    for (const ActionRecord::Installation& installation: record->installations) {
+      writer.writeInt(installation.output);
+      writer.writeInt(installation.location);
+      writer.writeString(installation.name);
+    }
+  }
+
+  if (writer.save(tmp->relative(SNAPSHOT_NAME).get())) {
+    actionRecordsChanged = false;
+  }
+}
+
+Hash Driver::externalFileHash(const std::string& path) {
+  struct stat stats;
+  if (stat(path.c_str(), &stats) < 0) {
+    externalFiles.erase(path);
+    return Hash::NULL_HASH;
+  } else if (!S_ISREG(stats.st_mode)) {
+    // Typically a directory searched for headers.  All that matters is that it's there.
+    static const Hash NOT_REGULAR_HASH = Hash::of("ekam: not a regular file");
+    return NOT_REGULAR_HASH;
+  }
+
+  ExternalFile file;
+  file.device = stats.st_dev;
+  file.inode = stats.st_ino;
+  file.size = stats.st_size;
+  file.modifiedNs = stats.st_mtim.tv_sec * 1000000000ull + stats.st_mtim.tv_nsec;
+  file.changedNs = stats.st_ctim.tv_sec * 1000000000ull + stats.st_ctim.tv_nsec;
+
+  auto iter = externalFiles.find(path);
+  if (iter != externalFiles.end() && iter->second.device == file.device &&
+      iter->second.inode == file.inode && iter->second.size == file.size &&
+      iter->second.modifiedNs == file.modifiedNs && iter->second.changedNs == file.changedNs) {
+    return iter->second.contentHash;
+  }
+
+  file.contentHash = DiskFile(path, NULL).contentHash();
+  ++counters.filesHashed;
+  externalFiles[path] = file;
+  return file.contentHash;
+}
 
 void Driver::addActionFactory(ActionFactory* factory) {
   std::vector<Tag> triggerTags;
@@ -565,11 +1391,34 @@ void Driver::addActionFactory(ActionFactory* factory) {
   }
 }
 
+void Driver::setVerbLimit(const std::string& verb, int limit) {
+  verbLimits[verb] = limit;
+}
+
+void Driver::setJobserver(Jobserver* jobserver) {
+  this->jobserver = jobserver;
+}
+
+void Driver::setTrace(Trace* trace) {
+  this->trace = trace;
+}
+
+void Driver::disableReplay() {
+  replayDisabled = true;
+}
+
+void Driver::addTarget(const std::string& name) {
+  targets.push_back(name);
+  targetsMatched.push_back(false);
+}
+
 void Driver::addSourceFile(File* file) {
   OwnedPtr<Provision> provision;
   if (rootProvisions.release(file, &provision)) {
-    // Source file was modified.  Reset all actions dependent on the old version.
-    resetDependentActions(provision.get());
+    // Source file was modified.  Reset all actions dependent on the old version, and hurry
+    // them along, since the user is presumably waiting to see the effect of the change.
+    prioritizing = true;
+    resetForEdit(provision.get());
   }
 
   // Apply default tag.
@@ -579,17 +1428,27 @@ void Driver::addSourceFile(File* file) {
   provision = newOwned<Provision>();
   provision->creator = nullptr;
   provision->file = file->clone();
-  registerProvider(provision.get(), tags, std::unordered_set<ActionDriver*>());
+  registerProvider(provision.get(), tags);
   File* key = provision->file.get();  // cannot inline due to undefined evaluation order
   rootProvisions.add(key, provision.release());
+  prioritizing = false;
 
   startSomeActions();
 }
 
+void Driver::finishedInitialScan() {
+  finishedScan = true;
+
+  // In case the build is already idle.
+  startSomeActions();
+}
+
 void Driver::removeSourceFile(File* file) {
   OwnedPtr<Provision> provision;
   if (rootProvisions.release(file, &provision)) {
-    resetDependentActions(provision.get());
+    prioritizing = true;
+    resetForEdit(provision.get());
+    prioritizing = false;
 
     // In case some active actions were canceled.
     startSomeActions();
@@ -598,11 +1457,203 @@ void Driver::removeSourceFile(File* file) {
   }
 }
 
+void Driver::writeMetrics(Metrics* metrics) {
+  metrics->declare("ekam_actions", Metrics::GAUGE, "Actions in each of the driver's queues.");
+  struct { const char* name; int size; } queues[] = {
+    { "active", activeActions.size() },
+    { "priority", priorityActions.size() },
+    { "pending", pendingActions.size() },
+    { "inline", inlineActions.size() },
+    { "deferred", deferredActions.size() },
+    { "awaiting", awaitingActions.size() },
+    { "completed", completedActionPtrs.size() },
+  };
+  for (auto& queue: queues) {
+    metrics->sample("ekam_actions", queue.size, Metrics::label("queue", queue.name));
+  }
+  metrics->gauge("ekam_slots", "Actions that may run processes at once, including slots that "
+                 "running actions have asked for.", maxConcurrentActions + extraSlots);
+
+  metrics->declare("ekam_actions_started_total", Metrics::COUNTER,
+                   "Actions started, by how they ran.");
+  metrics->sample("ekam_actions_started_total", counters.actionsStarted,
+                  Metrics::label("how", "process"));
+  metrics->sample("ekam_actions_started_total", counters.actionsRunInline,
+                  Metrics::label("how", "inline"));
+  metrics->sample("ekam_actions_started_total", counters.actionsReplayed,
+                  Metrics::label("how", "replayed"));
+
+  metrics->declare("ekam_actions_finished_total", Metrics::COUNTER,
+                   "Actions finished, by outcome.");
+  metrics->sample("ekam_actions_finished_total", counters.actionsDone,
+                  Metrics::label("outcome", "done"));
+  metrics->sample("ekam_actions_finished_total", counters.actionsPassed,
+                  Metrics::label("outcome", "passed"));
+  metrics->sample("ekam_actions_finished_total", counters.actionsFailed,
+                  Metrics::label("outcome", "failed"));
+  metrics->sample("ekam_actions_finished_total", counters.actionsCancelled,
+                  Metrics::label("outcome", "cancelled"));
+
+  metrics->counter("ekam_actions_reset_total",
+                   "Actions reset because something they used changed.", counters.actionsReset);
+  metrics->counter("ekam_provider_lookups_total", "Calls to findProvider() by actions.",
+                   counters.providerLookups);
+  metrics->counter("ekam_files_hashed_total", "Files hashed as they were provided.",
+                   counters.filesHashed);
+  metrics->counter("ekam_hashed_bytes_total", "Bytes hashed, mostly file contents.",
+                   Hash::getBytesHashed());
+
+  // A table's erased rows linger until enough pile up to be worth compacting.
+  struct { const char* name; int rows; int deleted; int capacity; } tables[] = {
+    { "tags", tagTable.size(), tagTable.deletedRows(), tagTable.capacity() },
+    { "dependencies", dependencyTable.size(), dependencyTable.deletedRows(),
+      dependencyTable.capacity() },
+    { "triggers", triggers.size(), triggers.deletedRows(), triggers.capacity() },
+    { "action_triggers", actionTriggersTable.size(), actionTriggersTable.deletedRows(),
+      actionTriggersTable.capacity() },
+  };
+  metrics->declare("ekam_table_rows", Metrics::GAUGE, "Rows in each of the driver's tables.");
+  for (auto& table: tables) {
+    metrics->sample("ekam_table_rows", table.rows, Metrics::label("table", table.name));
+  }
+  metrics->declare("ekam_table_deleted_rows", Metrics::GAUGE,
+                   "Erased rows not yet compacted out of each table.");
+  for (auto& table: tables) {
+    metrics->sample("ekam_table_deleted_rows", table.deleted, Metrics::label("table", table.name));
+  }
+  metrics->declare("ekam_table_capacity_rows", Metrics::GAUGE,
+                   "Rows each table has room for before it must grow.");
+  for (auto& table: tables) {
+    metrics->sample("ekam_table_capacity_rows", table.capacity,
+                    Metrics::label("table", table.name));
+  }
+
+  metrics->gauge("ekam_provider_indexes", "Tags with enough providers to be indexed.",
+                 providerIndexes.size());
+  metrics->gauge("ekam_action_records", "Completed actions remembered for replay.",
+                 actionRecords.size());
+}
+
+void Driver::prioritize(const std::string& name) {
+  std::string::size_type slashPos = name.rfind('/');
+  std::string::size_type dotPos = name.rfind('.');
+  std::string stem = name;
+  if (dotPos != std::string::npos && (slashPos == std::string::npos || dotPos > slashPos)) {
+    stem.erase(dotPos);
+  }
+
+  // Matching actions join a new round of resets, so that promoteLatestResets() puts them
+  // first.
+  beginResetRound();
+  OwnedPtrDeque<ActionDriver> others;
+  while (!priorityActions.empty()) {
+    OwnedPtr<ActionDriver> action = priorityActions.popFront();
+    if (matchesStem(action->srcName, stem)) {
+      action->resetRound = resetRound;
+      latestResets.pushBack(action.release());
+    } else {
+      others.pushBack(action.release());
+    }
+  }
+  priorityActions.swap(&others);
+
+  while (!pendingActions.empty()) {
+    OwnedPtr<ActionDriver> action = pendingActions.popFront();
+    if (matchesStem(action->srcName, stem)) {
+      action->prioritized = true;
+      action->resetRound = resetRound;
+      latestResets.pushBack(action.release());
+    } else {
+      others.pushBack(action.release());
+    }
+  }
+  pendingActions.swap(&others);
+
+  bool found = !latestResets.empty();
+  promoteLatestResets();
+
+  if (found) {
+    startSomeActions();
+  }
+}
+
+bool Driver::matchesStem(const std::string& canonicalName, const std::string& stem) {
+  return canonicalName.compare(0, stem.size(), stem) == 0 &&
+         (canonicalName.size() == stem.size() || canonicalName[stem.size()] == '.');
+}
+
+void Driver::resetForEdit(Provision* provision) {
+  beginResetRound();
+  resetDependentActions(provision);
+  promoteLatestResets();
+}
+
+void Driver::beginResetRound() {
+  // Rounds don't nest, but if one were left open, its actions belong ahead of the new round's.
+  promoteLatestResets();
+  ++resetRound;
+  collectingResets = true;
+}
+
+void Driver::promoteLatestResets() {
+  // The latest change is the one the user is waiting on, so actions reset due to it go ahead of
+  // other prioritized actions, keeping their relative order.
+  collectingResets = false;
+  while (!latestResets.empty()) {
+    priorityActions.pushFront(latestResets.popBack());
+  }
+}
+
 void Driver::startSomeActions() {
-  while (activeActions.size() < maxConcurrentActions && !pendingActions.empty()) {
+  runInlineActions();
+
+  // Something has presumably finished since we last got here, so give actions that were
+  // waiting on it another look.
+  while (!awaitingActions.empty()) {
+    OwnedPtr<ActionDriver> action = awaitingActions.popBack();
+    OwnedPtrDeque<ActionDriver>& queue = queueFor(action.get());
+    queue.pushFront(action.release());
+  }
+
+  std::unordered_map<std::string, int> runningVerbs = countRunningVerbs();
+  returnJobserverTokens(activeActions.size() + extraSlots);
+
+  while (activeActions.size() + extraSlots < maxConcurrentActions &&
+         (!priorityActions.empty() || !pendingActions.empty())) {
+    OwnedPtrDeque<ActionDriver>* queue = &priorityActions;
+    int index = choosePendingAction(*queue, runningVerbs);
+    if (index < 0) {
+      queue = &pendingActions;
+      index = choosePendingAction(*queue, runningVerbs);
+      if (index < 0) break;
+    }
+
+    if (queue->get(index)->canReplay()) {
+      // Doesn't need a slot.
+      if (activityObserver != nullptr) activityObserver->startingAction();
+      OwnedPtr<ActionDriver> actionDriver = queue->releaseAndShift(index);
+      ActionDriver* ptr = actionDriver.get();
+      activeActions.add(actionDriver.release());
+      ptr->replay();  // removes itself from activeActions
+      continue;
+    }
+
+    if (!activeActions.empty() && queue->get(index)->awaitsRecordedInputs()) {
+      // It would probably just fail, and in doing so spoil its outputs for replay later.
+      awaitingActions.pushBack(queue->releaseAndShift(index));
+      continue;
+    }
+
+    if (!tryTakeJobserverToken(activeActions.size() + extraSlots)) {
+      // Subprocesses have borrowed the rest of our slots.
+      waitForJobserverToken();
+      break;
+    }
+
     if (activityObserver != nullptr) activityObserver->startingAction();
-    OwnedPtr<ActionDriver> actionDriver = pendingActions.popFront();
+    OwnedPtr<ActionDriver> actionDriver = queue->releaseAndShift(index);
     ActionDriver* ptr = actionDriver.get();
+    ++runningVerbs[ptr->verb];
     activeActions.add(actionDriver.release());
     try {
       ptr->start();
@@ -614,11 +1665,247 @@ void Driver::startSomeActions() {
   }
 
   if (activeActions.size() == 0) {
+    if (!awaitingActions.empty()) {
+      // Nothing is left that could provide what they're waiting for, so run them all, as
+      // slots allow, rather than one at a time.
+      for (int i = 0; i < awaitingActions.size(); i++) {
+        awaitingActions.get(i)->mayAwait = false;
+      }
+      startSomeActions();
+      return;
+    }
+
+    if (releaseDeferredActions()) {
+      startSomeActions();
+      return;
+    }
+
+    if (finishedScan) {
+      warnUnmatchedTargets();
+    }
+
+    if (jobserver != nullptr) {
+      // Nothing is running, so every token should be back in the pool.  Any that aren't were
+      // leaked by children that died while holding them.
+      jobserver->refill();
+    }
+
+    if (actionRecordsChanged) {
+      saveSnapshot();
+    }
+
+    reportVerbUsage();
     bool hasFailures = dumpErrors();
+    if (trace != nullptr) trace->flush();
     if (activityObserver != nullptr) activityObserver->idle(hasFailures);
   }
 }
 
+int Driver::choosePendingAction(const OwnedPtrDeque<ActionDriver>& queue,
+                                const std::unordered_map<std::string, int>& runningVerbs) {
+  if (queue.empty()) {
+    return -1;
+  } else if (verbLimits.empty()) {
+    return 0;
+  }
+
+  // Take the first action in the queue whose verb's pool has room.  Actions further back are
+  // allowed to jump ahead of ones blocked on a full pool so that e.g. compiles can proceed
+  // while links are throttled.
+  for (int i = 0; i < queue.size(); i++) {
+    ActionDriver* candidate = queue.get(i);
+
+    auto limit = verbLimits.find(candidate->verb);
+    if (limit != verbLimits.end()) {
+      auto running = runningVerbs.find(candidate->verb);
+      if (running != runningVerbs.end() && running->second >= limit->second) continue;
+    }
+
+    return i;
+  }
+
+  return -1;
+}
+
+std::unordered_map<std::string, int> Driver::countRunningVerbs() {
+  std::unordered_map<std::string, int> result;
+  for (int i = 0; i < activeActions.size(); i++) {
+    ActionDriver* action = activeActions.get(i);
+    result[action->verb] += 1 + action->extraSlots;
+  }
+  return result;
+}
+
+bool Driver::tryTakeJobserverToken(int slotsInUse) {
+  // Like a make process, we get our first job slot for free, and need a token for each
+  // additional one.
+  if (jobserver == nullptr || jobserverTokens >= slotsInUse) {
+    return true;
+  } else if (jobserver->tryAcquire()) {
+    ++jobserverTokens;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+void Driver::returnJobserverTokens(int slotsInUse) {
+  while (jobserverTokens > std::max(0, slotsInUse - 1)) {
+    jobserver->release();
+    --jobserverTokens;
+  }
+}
+
+void Driver::waitForJobserverToken() {
+  if (!waitingForJobserver) {
+    waitingForJobserver = true;
+    jobserverWait = eventManager->when(jobserver->onAvailable(eventManager))(
+      [this](Void) {
+        waitingForJobserver = false;
+        jobserverWait.release();
+        startSomeActions();
+      });
+  }
+}
+
+void Driver::runInlineActions() {
+  // Running an inline action usually triggers more of them (e.g. scanning a file may cause
+  // another in-process rule to fire on it), so keep going until the queue is drained.
+  while (!inlineActions.empty()) {
+    if (activityObserver != nullptr) activityObserver->startingAction();
+    OwnedPtr<ActionDriver> actionDriver = inlineActions.popFront();
+    ActionDriver* ptr = actionDriver.get();
+    activeActions.add(actionDriver.release());
+    ptr->runInline();  // removes itself from activeActions
+  }
+}
+
+void Driver::deletePendingAction(ActionDriver* action) {
+  // TODO:  Use better data structure for pendingActions.  For now we have to iterate
+  //   through the whole thing to find the action we're deleting.  We iterate from the back
+  //   since it's likely the action was just added there.
+  OwnedPtrDeque<ActionDriver>* queues[] = { &queueFor(action), &awaitingActions };
+  for (OwnedPtrDeque<ActionDriver>* queue: queues) {
+    for (int k = queue->size() - 1; k >= 0; k--) {
+      if (queue->get(k) == action) {
+        queue->releaseAndShift(k);
+        return;
+      }
+    }
+  }
+}
+
+OwnedPtrDeque<Driver::ActionDriver>& Driver::queueFor(ActionDriver* action) {
+  if (action->inProcess) {
+    return inlineActions;
+  } else if (action->deferred) {
+    return deferredActions;
+  } else if (action->prioritized) {
+    return collectingResets && action->resetRound == resetRound ? latestResets : priorityActions;
+  } else {
+    return pendingActions;
+  }
+}
+
+bool Driver::isTarget(const std::string& canonicalName) {
+  // Check every target, not just until the first match, so that warnUnmatchedTargets() knows
+  // about each one that matched.
+  bool result = false;
+  for (size_t i = 0; i < targets.size(); i++) {
+    const std::string& target = targets[i];
+    if (target.empty() ||
+        (canonicalName.compare(0, target.size(), target) == 0 &&
+         (canonicalName.size() == target.size() || target.back() == '/' ||
+          canonicalName[target.size()] == '/' || canonicalName[target.size()] == '.'))) {
+      // Everything, exact match, file in the target directory, or e.g. "foo.cpp" for target
+      // "foo".
+      targetsMatched[i] = true;
+      result = true;
+    }
+  }
+  return result;
+}
+
+void Driver::warnUnmatchedTargets() {
+  // Nothing is left that could match a target that hasn't matched anything yet, so it's most
+  // likely misspelled.
+  if (checkedTargets) {
+    return;
+  }
+  checkedTargets = true;
+
+  for (size_t i = 0; i < targets.size(); i++) {
+    if (!targetsMatched[i]) {
+      OwnedPtr<Dashboard::Task> task =
+          dashboard->beginTask("warning", targets[i], Dashboard::NORMAL);
+      task->addOutput("No source file or generated file matches this target.\n");
+      task->setState(Dashboard::DONE);
+    }
+  }
+}
+
+bool Driver::releaseDeferredActions() {
+  if (deferredActions.empty()) {
+    return false;
+  }
+
+  bool blocked = false;
+  std::unordered_set<std::string> interests;  // files the targets are built from
+  for (OwnedPtrMap<ActionDriver*, ActionDriver>::Iterator iter(completedActionPtrs); iter.next();) {
+    ActionDriver* action = iter.key();
+    if (!action->wanted) continue;
+
+    interests.insert(action->srcName);
+    for (DependencyTable::SearchIterator<DependencyTable::ACTION> dep(dependencyTable, action);
+         dep.next();) {
+      Provision* provision = dep.cell<DependencyTable::PROVISION>();
+      if (provision == nullptr) {
+        // The action looked for something nobody provides -- perhaps something an action we
+        // skipped would provide.  Lookups that come up empty are routine for actions that
+        // succeed anyway (e.g. a link looking for libc's symbols), so only failures count.
+        blocked = blocked || action->state == ActionDriver::FAILED;
+      } else {
+        interests.insert(provision->canonicalName);
+      }
+    }
+  }
+  if (!blocked) {
+    // Every target was built, or failed despite finding everything it asked for (e.g. a compile
+    // error).  Whatever is left over isn't needed.
+    return false;
+  }
+
+  // Some target is blocked, perhaps on something provided by an action we skipped.  We can't
+  // know which without running them, so release those closest to the files the targets are
+  // built from, since the preferred provider of a tag is the closest one.  If that doesn't
+  // help, we'll come back for the next-closest once they're done.
+  std::vector<int> values;
+  int closest = 0;
+  for (int i = 0; i < deferredActions.size(); i++) {
+    int value = 0;
+    for (const std::string& interest: interests) {
+      value = std::max(value, closeness(deferredActions.get(i)->srcName, interest));
+    }
+    values.push_back(value);
+    closest = std::max(closest, value);
+  }
+
+  OwnedPtrDeque<ActionDriver> remaining;
+  for (int value: values) {
+    OwnedPtr<ActionDriver> action = deferredActions.popFront();
+    if (value == closest) {
+      action->deferred = false;
+      action->getDashboardTask();
+      pendingActions.pushBack(action.release());
+    } else {
+      remaining.pushBack(action.release());
+    }
+  }
+  deferredActions.swap(&remaining);
+
+  return true;
+}
+
 void Driver::rescanForNewFactory(ActionFactory* factory) {
   // Apply triggers.
   std::vector<Tag> triggerTags;
@@ -626,9 +1913,10 @@ void Driver::rescanForNewFactory(ActionFactory* factory) {
   for (unsigned int i = 0; i < triggerTags.size(); i++) {
     for (TagTable::SearchIterator<TagTable::TAG> iter(tagTable, triggerTags[i]); iter.next();) {
       Provision* provision = iter.cell<TagTable::PROVISION>();
-      OwnedPtr<Action> action = factory->tryMakeAction(triggerTags[i], provision->file.get());
-      if (action != NULL) {
-        queueNewAction(factory, action.release(), provision);
+      OwnedPtrVector<Action> actions;
+      factory->tryMakeActions(triggerTags[i], provision->file.get(), actions.appender());
+      for (int j = 0; j < actions.size(); j++) {
+        queueNewAction(factory, actions.release(j), provision);
       }
     }
   }
@@ -636,53 +1924,93 @@ void Driver::rescanForNewFactory(ActionFactory* factory) {
 
 void Driver::queueNewAction(ActionFactory* factory, OwnedPtr<Action> action,
                             Provision* provision) {
-  OwnedPtr<Dashboard::Task> task = dashboard->beginTask(
-      action->getVerb(), provision->file->canonicalName(),
-      action->isSilent() ? Dashboard::SILENT : Dashboard::NORMAL);
-
   OwnedPtr<ActionDriver> actionDriver =
-      newOwned<ActionDriver>(this, action.release(), provision->file.get(), provision->contentHash,
-                             task.release());
+      newOwned<ActionDriver>(this, action.release(), provision->file.get(), provision->contentHash);
   actionTriggersTable.add(factory, provision, actionDriver.get());
+  actionDriver->prioritized = prioritizing;
+
+  if (!targets.empty()) {
+    actionDriver->wanted = isTarget(actionDriver->srcName) ||
+        (provision->creator != nullptr && provision->creator->wanted);
+    // Silent actions are trivial (e.g. tagging headers), and what they provide is needed to
+    // work out what else is needed, so they aren't worth deferring.
+    actionDriver->deferred = !actionDriver->wanted && !actionDriver->inProcess &&
+        !actionDriver->action->isSilent() && !actionDriver->action->isAlwaysNeeded();
+  }
+
+  if (actionDriver->inProcess) {
+    // Will be run by the next startSomeActions(), before any processes are started.
+    inlineActions.pushBack(actionDriver.release());
+    return;
+  }
+
+  if (!actionDriver->deferred) {
+    actionDriver->getDashboardTask();
+  }
 
   // Put new action on front of queue because it was probably triggered by another action that
   // just completed, and it's good to run related actions together to improve cache locality.
-  pendingActions.pushFront(actionDriver.release());
+  queueFor(actionDriver.get()).pushFront(actionDriver.release());
 }
 
-void Driver::getTransitiveDependencies(
-    ActionDriver* action, std::unordered_set<ActionDriver*>* deps) {
-  if (action != nullptr && deps->insert(action).second) {
-    for (ActionTriggersTable::SearchIterator<ActionTriggersTable::ACTION>
-         iter(actionTriggersTable, action); iter.next();) {
-      getTransitiveDependencies(iter.cell<ActionTriggersTable::PROVISION>()->creator, deps);
-    }
-    for (DependencyTable::SearchIterator<DependencyTable::ACTION>
-         iter(dependencyTable, action); iter.next();) {
-      Provision* provision = iter.cell<DependencyTable::PROVISION>();
-      if (provision != nullptr) {
-        getTransitiveDependencies(provision->creator, deps);
-      }
-    }
+bool Driver::isAncestor(ActionDriver* candidate, ActionDriver* descendant) {
+  if (descendant == nullptr) {
+    // Source files don't depend on anything.
+    return false;
+  } else if (candidate == descendant) {
+    return true;
+  } else if (candidate->isRunning || (candidate->state != ActionDriver::DONE &&
+                                      candidate->state != ActionDriver::PASSED)) {
+    // Only actions which completed successfully have outputs that anyone could depend on.
+    // This is the common case -- most actions waiting on a new tag are blocked on it -- so
+    // we avoid computing the ancestor set at all.
+    return false;
+  } else {
+    return descendant->getAncestors().count(candidate) > 0;
   }
 }
 
-void Driver::registerProvider(Provision* provision, const std::vector<Tag>& tags,
-                              const std::unordered_set<ActionDriver*>& dependencies) {
+void Driver::registerProvider(Provision* provision, const std::vector<Tag>& tags) {
+  uint64_t hashStart = trace == nullptr ? 0 : trace->now();
   provision->contentHash = provision->file->contentHash();
+  provision->canonicalName = provision->file->canonicalName();
+  ++counters.filesHashed;
+  if (trace != nullptr) {
+    trace->complete(Trace::EVENT_LOOP_TRACK, "driver", "hash", hashStart,
+                    Trace::Args().add("file", provision->canonicalName));
+  }
+  provision->depth = fileDepth(provision->canonicalName);
+
+  // Whatever a prioritized action affects is prioritized too, so that priority flows from an
+  // edited file all the way down to the tests that exercise it.
+  bool wasPrioritizing = prioritizing;
+  bool hurry = provision->creator != nullptr && provision->creator->prioritized;
+  if (hurry) {
+    prioritizing = true;
+    beginResetRound();
+  }
 
   for (std::vector<Tag>::const_iterator iter = tags.begin(); iter != tags.end(); ++iter) {
     const Tag& tag = *iter;
     tagTable.add(tag, provision);
 
-    resetDependentActions(tag, dependencies);
+    ProviderIndex* index = providerIndexes.get(tag);
+    if (index != nullptr) {
+      index->add(provision);
+    }
+
+    resetDependentActions(tag, provision->creator);
 
     fireTriggers(tag, provision);
   }
+
+  if (hurry) {
+    promoteLatestResets();
+  }
+  prioritizing = wasPrioritizing;
 }
 
-void Driver::resetDependentActions(const Tag& tag,
-                                   const std::unordered_set<ActionDriver*>& dependencies) {
+void Driver::resetDependentActions(const Tag& tag, ActionDriver* provider) {
   std::unordered_set<Provision*> provisionsToReset;
 
   std::vector<ActionDriver*> actionsToReset;
@@ -693,7 +2021,7 @@ void Driver::resetDependentActions(const Tag& tag,
 
     // Don't reset an action that contributed to the creation of this tag in the first place, since
     // that would lead to an infinite loop of rebuilding the same action.
-    if (dependencies.count(action) == 0) {
+    if (!isAncestor(action, provider)) {
       Provision* previousProvider = iter.cell<DependencyTable::PROVISION>();
 
       if (action->choosePreferredProvider(tag) != previousProvider) {
@@ -715,6 +2043,8 @@ void Driver::resetDependentActions(const Tag& tag,
 }
 
 void Driver::resetDependentActions(Provision* provision) {
+  uint64_t traceStart = trace == nullptr ? 0 : trace->now();
+
   // Reset dependents of this provision.
   {
     std::vector<ActionDriver*> actionsToReset;
@@ -748,39 +2078,74 @@ void Driver::resetDependentActions(Provision* provision) {
 
     for (size_t j = 0; j < actionsToDelete.size(); j++) {
       actionsToDelete[j]->reset();
-
-      // TODO:  Use better data structure for pendingActions.  For now we have to iterate
-      //   through the whole thing to find the action we're deleting.  We iterate from the back
-      //   since it's likely the action was just added there.
-      for (int k = pendingActions.size() - 1; k >= 0; k--) {
-        if (pendingActions.get(k) == actionsToDelete[j]) {
-          pendingActions.releaseAndShift(k);
-          break;
-        }
-      }
+      deletePendingAction(actionsToDelete[j]);
     }
 
     actionTriggersTable.erase<ActionTriggersTable::PROVISION>(provision);
   }
 
+  for (TagTable::SearchIterator<TagTable::PROVISION> iter(tagTable, provision); iter.next();) {
+    const Tag& tag = iter.cell<TagTable::TAG>();
+    ProviderIndex* index = providerIndexes.get(tag);
+    if (index != nullptr) {
+      index->remove(provision);
+      if (index->empty()) {
+        OwnedPtr<ProviderIndex> dead;
+        providerIndexes.release(tag, &dead);
+      }
+    }
+  }
+
   tagTable.erase<TagTable::PROVISION>(provision);
+
+  if (trace != nullptr) {
+    trace->complete(Trace::EVENT_LOOP_TRACK, "driver", "resetDependentActions", traceStart,
+                    Trace::Args().add("file", provision->canonicalName));
+  }
 }
 
 void Driver::fireTriggers(const Tag& tag, Provision* provision) {
   for (TriggerTable::SearchIterator<TriggerTable::TAG> iter(triggers, tag); iter.next();) {
     ActionFactory* factory = iter.cell<TriggerTable::FACTORY>();
-    OwnedPtr<Action> triggeredAction = factory->tryMakeAction(tag, provision->file.get());
-    if (triggeredAction != NULL) {
-      queueNewAction(factory, triggeredAction.release(), provision);
+    OwnedPtrVector<Action> triggeredActions;
+    factory->tryMakeActions(tag, provision->file.get(), triggeredActions.appender());
+    for (int i = 0; i < triggeredActions.size(); i++) {
+      queueNewAction(factory, triggeredActions.release(i), provision);
     }
   }
 }
 
+void Driver::reportVerbUsage() {
+  if (verbUsage.empty()) {
+    return;
+  }
+
+  std::string text;
+  for (auto& entry: verbUsage) {
+    const ResourceUsage& usage = entry.second.total;
+    char numbers[256];
+    snprintf(numbers, sizeof(numbers), "%d actions, %.2fs user, %.2fs sys, %.1f MB peak",
+             entry.second.actions, usage.userMicros / 1e6, usage.systemMicros / 1e6,
+             usage.maxRssKb / 1024.0);
+    text += entry.first + ": " + numbers + " (" + entry.second.largestNoun + ")";
+    snprintf(numbers, sizeof(numbers), ", %lld blocks in, %lld out, %lld context switches\n",
+             usage.blockInputs, usage.blockOutputs,
+             usage.voluntarySwitches + usage.involuntarySwitches);
+    text += numbers;
+  }
+  verbUsage.clear();
+
+  OwnedPtr<Dashboard::Task> task =
+      dashboard->beginTask("summary", "resources used by each verb", Dashboard::NORMAL);
+  task->addOutput(text);
+  task->setState(Dashboard::DONE);
+}
+
 bool Driver::dumpErrors() {
   bool hasFailures = false;
   for (OwnedPtrMap<ActionDriver*, ActionDriver>::Iterator iter(completedActionPtrs); iter.next();) {
     if (iter.key()->state == ActionDriver::FAILED) {
-      iter.value()->dashboardTask->setState(Dashboard::FAILED);
+      iter.value()->getDashboardTask()->setState(Dashboard::FAILED);
       hasFailures = true;
     }
   }
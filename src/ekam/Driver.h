@@ -19,19 +19,23 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <map>
 #include <memory>
 #include <set>
 
 #include "base/OwnedPtr.h"
 #include "os/File.h"
+#include "os/Jobserver.h"
 #include "Action.h"
 #include "Tag.h"
 #include "Dashboard.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include "base/Table.h"
 
 namespace ekam {
 
-class Driver {
+class Driver : public Dashboard::RequestHandler {
 public:
   class ActivityObserver {
   public:
@@ -46,11 +50,49 @@ public:
 
   void addActionFactory(ActionFactory* factory);
 
+  // Limit the number of actions with the given verb which may run concurrently.  These
+  // actions still count against maxConcurrentActions as well.
+  void setVerbLimit(const std::string& verb, int limit);
+
+  // Share the concurrency limit with subprocesses through the given jobserver, which should
+  // hold maxConcurrentActions - 1 tokens.
+  void setJobserver(Jobserver* jobserver);
+
+  // Record each action's time in the queue and running, along with the driver's own
+  // bookkeeping, to the given trace.
+  void setTrace(Trace* trace);
+
+  // Never complete an action by replaying an earlier run's outcome; run everything.  Outcomes
+  // are still recorded, so a later Ekam process may replay them.  Call before adding files.
+  void disableReplay();
+
+  // Build only the given target and what it needs, rather than everything.  `name` is a
+  // canonical name (e.g. "foo/bar_test") or directory (e.g. "foo/").  Anything whose canonical
+  // name is or is under it counts as a target, as does everything derived from a target.
+  // Other actions are deferred, and are released only when some target is blocked, starting
+  // with those closest to the blocked target in the directory tree.  May be called several
+  // times.
+  void addTarget(const std::string& name);
+
   void addSourceFile(File* file);
   void removeSourceFile(File* file);
 
+  // Called once every source file present at startup has been added.  Once the resulting build
+  // goes idle, a dashboard warning is shown for each target that nothing matched.
+  void finishedInitialScan();
+
+  // Adds the driver's queue lengths, table sizes, and counts of what it has done so far.
+  void writeMetrics(Metrics* metrics);
+
+  // implements Dashboard::RequestHandler ------------------------------------------------
+  // Moves queued actions on the given file, or on files named after it (e.g. "foo/bar.o" and
+  // "foo/bar" for "foo/bar.c++"), to the front of the queue.  Actions which follow from them
+  // are prioritized in turn, as for an edited file.
+  void prioritize(const std::string& name);
+
 private:
   class ActionDriver;
+  class ProviderIndex;
 
   EventManager* eventManager;
   Dashboard* dashboard;
@@ -59,8 +101,16 @@ private:
   File* installDirs[BuildContext::INSTALL_LOCATION_COUNT];
 
   int maxConcurrentActions;
+  int extraSlots = 0;  // granted via BuildContext::acquireSlots()
+
+  Jobserver* jobserver = nullptr;
+  int jobserverTokens = 0;  // tokens held to cover our own slots beyond the first
+  bool waitingForJobserver = false;
+  Promise<void> jobserverWait;
+  std::unordered_map<std::string, int> verbLimits;
 
   ActivityObserver* activityObserver;
+  Trace* trace = nullptr;
 
   class TriggerTable : public Table<IndexedColumn<Tag, Tag::HashFunc>,
                                     IndexedColumn<ActionFactory*> > {
@@ -74,6 +124,14 @@ private:
     ActionDriver* creator;  // possibly null
     OwnedPtr<File> file;
     Hash contentHash;
+
+    // Cached when the provision is registered, for ranking providers.
+    std::string canonicalName;
+    int depth;
+
+    // Cached by findTagList().
+    std::string tagListPrefix;
+    OwnedPtr<std::vector<Tag> > tagList;
   };
 
   class TagTable : public Table<IndexedColumn<Tag, Tag::HashFunc>, IndexedColumn<Provision*> > {
@@ -83,8 +141,33 @@ private:
   };
   TagTable tagTable;
 
+  // Tags with many providers get an index for choosing the preferred one.
+  OwnedPtrMap<Tag, ProviderIndex, Tag::HashFunc> providerIndexes;
+
   OwnedPtrVector<ActionDriver> activeActions;
   OwnedPtrDeque<ActionDriver> pendingActions;
+  OwnedPtrDeque<ActionDriver> priorityActions;  // run before pendingActions
+  OwnedPtrDeque<ActionDriver> inlineActions;  // in-process actions; don't wait for a slot
+  OwnedPtrDeque<ActionDriver> deferredActions;  // not (yet) known to be needed by a target
+  // Actions whose last run read files which haven't been rebuilt yet.  Rather than run them
+  // now, only to fail, startSomeActions() sets them aside until something else finishes.
+  OwnedPtrDeque<ActionDriver> awaitingActions;
+
+  std::vector<std::string> targets;  // empty = build everything
+  std::vector<bool> targetsMatched;  // parallel to targets; whether any action was built from it
+  bool finishedScan = false;
+  bool checkedTargets = false;
+
+  // Set while handling a change whose consequences should be seen quickly, i.e. an edited
+  // source file or the outputs of a prioritized action.  Actions reset or created meanwhile
+  // are prioritized.
+  bool prioritizing = false;
+  int resetRound = 0;  // bumped for each change whose resets promoteLatestResets() hoists
+
+  // Prioritized actions reset in the current round, collected here instead of in
+  // priorityActions so that promoteLatestResets() can move them all to the front at once.
+  OwnedPtrDeque<ActionDriver> latestResets;
+  bool collectingResets = false;
   OwnedPtrMap<ActionDriver*, ActionDriver> completedActionPtrs;
 
   class DependencyTable : public Table<IndexedColumn<Tag, Tag::HashFunc>,
@@ -109,23 +192,112 @@ private:
 
   OwnedPtrMap<File*, Provision, File::HashFunc, File::EqualFunc> rootProvisions;
 
+  // What a completed action read and wrote, so that it need not be re-run when it is
+  // re-triggered by an identical file with identical inputs.  Keyed by
+  // ActionDriver::recordKey().  Saved to the snapshot file in tmp, so that a new Ekam process
+  // can pick up where the last one left off.
+  struct ActionRecord {
+    std::string factory;  // ActionFactory::getIdentity()
+    Hash srcHash;
+    bool passed;
+    std::vector<std::pair<Tag, Hash> > inputs;  // NULL_HASH if the tag had no provider
+    std::vector<std::pair<std::string, Hash> > externalInputs;  // see externalFileHash()
+
+    struct Output {
+      bool isSource;  // the trigger file itself, rather than a file in tmp
+      std::string name;  // canonical name, if not isSource
+      Hash contentHash;
+      std::vector<Tag> tags;
+    };
+    std::vector<Output> outputs;
+
+    struct Installation {
+      int output;  // index into outputs
+      BuildContext::InstallLocation location;
+      std::string name;
+    };
+    std::vector<Installation> installations;
+  };
+  OwnedPtrMap<std::string, ActionRecord> actionRecords;
+  bool actionRecordsChanged = false;  // since the snapshot was last written
+  bool replayDisabled = false;
+
+  // Files outside the source tree and tmp which actions have read (see
+  // BuildContext::noteInput()), by path, with their content hash as of the stat fields here.
+  struct ExternalFile {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    uint64_t modifiedNs;
+    uint64_t changedNs;
+    Hash contentHash;
+  };
+  std::unordered_map<std::string, ExternalFile> externalFiles;
+
+  // Resources used by each verb's processes since the driver was last idle, reported then.
+  struct VerbUsage {
+    int actions = 0;
+    ResourceUsage total;
+    std::string largestNoun;  // the action with the highest peak RSS
+  };
+  std::map<std::string, VerbUsage> verbUsage;
+
+  // Running totals for writeMetrics().
+  struct Counters {
+    uint64_t actionsStarted = 0;  // with a slot, to run a process
+    uint64_t actionsRunInline = 0;
+    uint64_t actionsReplayed = 0;
+    uint64_t actionsDone = 0;
+    uint64_t actionsPassed = 0;
+    uint64_t actionsFailed = 0;
+    uint64_t actionsCancelled = 0;  // reset while running
+    uint64_t actionsReset = 0;  // including cancellations
+    uint64_t providerLookups = 0;
+    uint64_t filesHashed = 0;
+  };
+  Counters counters;
+
   void startSomeActions();
+  int choosePendingAction(const OwnedPtrDeque<ActionDriver>& queue,
+                          const std::unordered_map<std::string, int>& runningVerbs);
+  OwnedPtrDeque<ActionDriver>& queueFor(ActionDriver* action);
+  bool isTarget(const std::string& canonicalName);
+  static bool matchesStem(const std::string& canonicalName, const std::string& stem);
+  bool releaseDeferredActions();
+  void warnUnmatchedTargets();
+  std::unordered_map<std::string, int> countRunningVerbs();
+  bool tryTakeJobserverToken(int slotsInUse);
+  void returnJobserverTokens(int slotsInUse);
+  void waitForJobserverToken();
+  void runInlineActions();
+  void deletePendingAction(ActionDriver* action);
 
   void rescanForNewFactory(ActionFactory* factory);
 
+  // The content hash of a file noted by BuildContext::noteInput(), rehashed only if its stat
+  // changes.  NULL_HASH if it doesn't exist.
+  Hash externalFileHash(const std::string& path);
+
+  void loadSnapshot();
+  void saveSnapshot();
+
   void queueNewAction(ActionFactory* factory, OwnedPtr<Action> action,
                       Provision* provision);
 
-  void getTransitiveDependencies(ActionDriver* action, std::unordered_set<ActionDriver*>* deps);
+  // Does `descendant` (transitively) consume the outputs of `candidate`?  `descendant` may be
+  // null, meaning a source file.
+  bool isAncestor(ActionDriver* candidate, ActionDriver* descendant);
 
-  void registerProvider(Provision* provision, const std::vector<Tag>& tags,
-                        const std::unordered_set<ActionDriver*>& dependencies);
-  void resetDependentActions(const Tag& tag,
-                             const std::unordered_set<ActionDriver*>& dependencies);
+  void registerProvider(Provision* provision, const std::vector<Tag>& tags);
+  void resetDependentActions(const Tag& tag, ActionDriver* provider);
   void resetDependentActions(Provision* provision);
+  void resetForEdit(Provision* provision);
+  void beginResetRound();
+  void promoteLatestResets();
   void fireTriggers(const Tag& tag, Provision* provision);
 
   bool dumpErrors();
+  void reportVerbUsage();
 };
 
 }  // namespace ekam
@@ -16,12 +16,14 @@
 
 #include "ExecPluginActionFactory.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <map>
 
 #include "os/Subprocess.h"
 #include "ActionUtil.h"
+#include "Snapshot.h"
 #include "base/Debug.h"
 
 namespace ekam {
@@ -41,6 +43,8 @@ std::string splitToken(std::string* line) {
   return result;
 }
 
+ExecPluginActionFactory::RequestStats requestStats = { 0, 0, 0 };
+
 }  // namespace
 
 // =======================================================================================
@@ -50,26 +54,32 @@ public:
   PluginDerivedActionFactory(OwnedPtr<File> executable,
                              std::string&& verb,
                              bool silent,
-                             std::vector<Tag>&& triggers);
+                             std::vector<Tag>&& triggers,
+                             std::vector<std::string>&& variants);
   ~PluginDerivedActionFactory();
 
   // implements ActionFactory -----------------------------------------------------------
   void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter);
   OwnedPtr<Action> tryMakeAction(const Tag& id, File* file);
+  void tryMakeActions(const Tag& id, File* file, OwnedPtrVector<Action>::Appender output);
+  std::string getIdentity();
 
 private:
   OwnedPtr<File> executable;
+  std::string identity;  // computed lazily
   std::string verb;
   bool silent;
   std::vector<Tag> triggers;
+  std::vector<std::string> variants;
 };
 
 // =======================================================================================
 
 class PluginDerivedAction : public Action {
 public:
-  PluginDerivedAction(File* executable, const std::string& verb, bool silent, File* file)
-      : executable(executable->clone()), verb(verb), silent(silent) {
+  PluginDerivedAction(File* executable, const std::string& verb, bool silent, File* file,
+                      const std::string& variant = std::string())
+      : executable(executable->clone()), verb(verb), silent(silent), variant(variant) {
     if (file != NULL) {
       this->file = file->clone();
     }
@@ -79,15 +89,26 @@ public:
   // implements Action -------------------------------------------------------------------
   std::string getVerb() { return verb; }
   bool isSilent() { return silent; }
+  std::string getVariant() { return variant; }
+  bool isAlwaysNeeded() { return file == NULL; }  // learning the rule
   Promise<void> start(EventManager* eventManager, BuildContext* context);
 
+  // When learning a rule, report what was learned to `learner` if it can be cached.
+  void setLearner(ExecPluginActionFactory* learner, const Hash& ruleHash) {
+    this->learner = learner;
+    this->ruleHash = ruleHash;
+  }
+
 private:
   class CommandReader;
 
   OwnedPtr<File> executable;
   std::string verb;
   bool silent;
+  std::string variant;  // empty for the default variant
   OwnedPtr<File> file;  // nullable
+  ExecPluginActionFactory* learner = nullptr;
+  Hash ruleHash;
 };
 
 class PluginDerivedAction::CommandReader {
@@ -97,7 +118,7 @@ public:
       : context(context), executable(executable->clone()),
         requestStream(requestStream.release()),
         responseStream(responseStream.release()),
-        lineReader(this->requestStream.get()), silent(false) {
+        lineReader(this->requestStream.get()), silent(false), pure(true) {
     if (input != NULL) {
       this->input = input->clone();
       knownFiles.add(input->canonicalName(), input->clone());
@@ -133,20 +154,36 @@ public:
       });
   }
 
+  // After learning a rule:  what was learned, if it can be cached.
+  OwnedPtr<ExecPluginActionFactory::LearnedRule> learnedRule;
+
 private:
   void consume(const std::string& line) {
-    if (findInCache(line)) return;
+    ++requestStats.requests;
+    if (findInCache(line)) {
+      ++requestStats.cacheHits;
+      return;
+    }
 
     std::string args = line;
     std::string command = splitToken(&args);
 
+    if (command != "verb" && command != "silent" && command != "trigger" &&
+        command != "variant") {
+      // The rule's output depends on more than its own content.
+      pure = false;
+    }
+
     if (command == "verb") {
       verb = args;
     } else if (command == "silent") {
       silent = true;
     } else if (command == "trigger") {
       triggers.push_back(Tag::fromName(args));
+    } else if (command == "variant") {
+      variants.push_back(args);
     } else if (command == "findProvider" || command == "findInput") {
+      ++requestStats.lookups;
       File* provider;
       if (command == "findProvider") {
         provider = context->findProvider(Tag::fromName(args));
@@ -170,6 +207,7 @@ private:
       }
       responseStream->writeAll("\n", 1);
     } else if (command == "findModifiers") {
+      ++requestStats.lookups;
       auto dir = input->parent();
       std::vector<File*> results;
       for (;;) {
@@ -200,8 +238,8 @@ private:
       context->log("newProvider not implemented");
       context->failed();
     } else if (command == "noteInput") {
-      // The action is reading some file outside the working directory.  For now we ignore this.
-      // TODO:  Pay attention?  We could trigger rebuilds when installed tools are updated, etc.
+      // The action is reading some file outside the working directory.
+      context->noteInput(args);
     } else if (command == "newOutput") {
       OwnedPtr<File> file = context->newOutput(args);
 
@@ -259,6 +297,10 @@ private:
           }
         }
       }
+    } else if (command == "acquireSlots") {
+      std::string granted = std::to_string(context->acquireSlots(atoi(args.c_str())));
+      responseStream->writeAll(granted.data(), granted.size());
+      responseStream->writeAll("\n", 1);
     } else if (command == "passed") {
       context->passed();
     } else {
@@ -284,9 +326,21 @@ private:
       context->provide(currentFile, tags);
     }
 
-    // Also register new triggers.
-    context->addActionType(newOwned<PluginDerivedActionFactory>(
-        executable.release(), std::move(verb), silent, std::move(triggers)));
+    if (input == NULL && pure) {
+      learnedRule = newOwned<ExecPluginActionFactory::LearnedRule>();
+      learnedRule->verb = verb;
+      learnedRule->silent = silent;
+      learnedRule->triggers = triggers;
+      learnedRule->variants = variants;
+    }
+
+    // Also register new triggers.  A factory without triggers would never do anything, and
+    // would make the action's outcome impossible to replay (see Driver::ActionRecord).
+    if (!triggers.empty()) {
+      context->addActionType(newOwned<PluginDerivedActionFactory>(
+          executable.release(), std::move(verb), silent, std::move(triggers),
+          std::move(variants)));
+    }
   }
 
 private:
@@ -300,6 +354,8 @@ private:
   std::string verb;
   bool silent;
   std::vector<Tag> triggers;
+  std::vector<std::string> variants;
+  bool pure;  // only declared the above
 
   OwnedPtrMap<std::string, File> knownFiles;
 
@@ -329,6 +385,9 @@ Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContex
   subprocess->addArgument(executable.get(), File::READ);
   if (file != NULL) {
     subprocess->addArgument(file->canonicalName());
+    if (!variant.empty()) {
+      subprocess->addArgument(variant);
+    }
   }
 
   OwnedPtr<ByteStream> responseStream = subprocess->captureStdin();
@@ -336,10 +395,12 @@ Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContex
   OwnedPtr<ByteStream> logStream = subprocess->captureStderr();
 
   auto subprocessWaitOp = eventManager->when(subprocess->start(eventManager))(
-    [context](ProcessExitCode exitCode) {
+    [context](ProcessExitCode exitCode) -> bool {
       if (exitCode.wasSignaled() || exitCode.getExitCode() != 0) {
         context->failed();
+        return false;
       }
+      return true;
     });
 
   auto commandReader = newOwned<CommandReader>(
@@ -349,19 +410,59 @@ Promise<void> PluginDerivedAction::start(EventManager* eventManager, BuildContex
   OwnedPtr<Logger> logger = newOwned<Logger>(context, logStream.release());
   auto logOp = logger->run(eventManager);
 
+  ExecPluginActionFactory* learner = this->learner;
+  Hash ruleHash = this->ruleHash;
+  std::string ruleName = executable->canonicalName();
   return eventManager->when(subprocessWaitOp, commandOp, logOp, subprocess, commandReader, logger)(
-      [](Void, Void, Void, OwnedPtr<Subprocess>, OwnedPtr<CommandReader>, OwnedPtr<Logger>){});
+      [learner, ruleHash, ruleName](bool succeeded, Void, Void, OwnedPtr<Subprocess>,
+                                    OwnedPtr<CommandReader> commandReader, OwnedPtr<Logger>) {
+        if (succeeded && learner != nullptr && commandReader->learnedRule != nullptr) {
+          commandReader->learnedRule->ruleHash = ruleHash;
+          learner->learned(ruleName, commandReader->learnedRule.release());
+        }
+      });
 }
 
 // =======================================================================================
 
+// Learns a rule from the cache rather than by running it.
+class LearnedRuleAction : public Action {
+public:
+  LearnedRuleAction(File* executable, const ExecPluginActionFactory::LearnedRule& rule)
+      : executable(executable->clone()), rule(rule) {}
+  ~LearnedRuleAction() {}
+
+  // implements Action -------------------------------------------------------------------
+  std::string getVerb() { return "learn"; }
+  bool isSilent() { return true; }
+  bool isInProcess() { return true; }
+  bool isAlwaysNeeded() { return true; }
+
+  Promise<void> start(EventManager* eventManager, BuildContext* context) {
+    if (!rule.triggers.empty()) {
+      context->addActionType(newOwned<PluginDerivedActionFactory>(
+          executable->clone(), std::string(rule.verb), rule.silent,
+          std::vector<Tag>(rule.triggers), std::vector<std::string>(rule.variants)));
+    }
+    return newFulfilledPromise();
+  }
+
+private:
+  OwnedPtr<File> executable;
+  ExecPluginActionFactory::LearnedRule rule;
+};
+
+// =======================================================================================
+
 PluginDerivedActionFactory::PluginDerivedActionFactory(OwnedPtr<File> executable,
                                                        std::string&& verb,
                                                        bool silent,
-                                                       std::vector<Tag>&& triggers)
+                                                       std::vector<Tag>&& triggers,
+                                                       std::vector<std::string>&& variants)
     : executable(executable.release()), silent(silent) {
   this->verb.swap(verb);
   this->triggers.swap(triggers);
+  this->variants.swap(variants);
 }
 PluginDerivedActionFactory::~PluginDerivedActionFactory() {}
 
@@ -375,11 +476,92 @@ OwnedPtr<Action> PluginDerivedActionFactory::tryMakeAction(const Tag& id, File*
   return newOwned<PluginDerivedAction>(executable.get(), verb, silent, file);
 }
 
+std::string PluginDerivedActionFactory::getIdentity() {
+  // The rule's behavior is determined by its code.
+  if (identity.empty()) {
+    identity = executable->canonicalName() + '@' + executable->contentHash().toString();
+  }
+  return identity;
+}
+
+void PluginDerivedActionFactory::tryMakeActions(const Tag& id, File* file,
+                                                OwnedPtrVector<Action>::Appender output) {
+  // One action for the default variant, plus one per declared variant.
+  output.add(tryMakeAction(id, file));
+  for (const std::string& variant: variants) {
+    output.add(newOwned<PluginDerivedAction>(executable.get(), verb, silent, file, variant));
+  }
+}
+
 // =======================================================================================
 
-ExecPluginActionFactory::ExecPluginActionFactory() {}
+namespace {
+
+const char LEARNED_RULES_NAME[] = ".ekam-rules";
+const char LEARNED_RULES_MAGIC[8] = { 'e', 'k', 'a', 'm', 'r', 'u', 'l', '1' };
+
+}  // namespace
+
+ExecPluginActionFactory::ExecPluginActionFactory(File* tmp)
+    : cacheFile(tmp->relative(LEARNED_RULES_NAME)) {
+  loadCache();
+}
 ExecPluginActionFactory::~ExecPluginActionFactory() {}
 
+ExecPluginActionFactory::RequestStats ExecPluginActionFactory::getRequestStats() {
+  return requestStats;
+}
+
+void ExecPluginActionFactory::learned(const std::string& ruleName, OwnedPtr<LearnedRule> rule) {
+  learnedRules.add(ruleName, rule.release());
+  saveCache();
+}
+
+void ExecPluginActionFactory::loadCache() {
+  SnapshotReader reader(cacheFile.get(), LEARNED_RULES_MAGIC);
+  while (reader.ok && !reader.atEnd()) {
+    std::string ruleName = reader.readString();
+    OwnedPtr<LearnedRule> rule = newOwned<LearnedRule>();
+    rule->ruleHash = reader.readHash();
+    rule->verb = reader.readString();
+    rule->silent = reader.readInt() != 0;
+    uint32_t count = reader.readCount(Hash::SIZE);
+    for (uint32_t i = 0; i < count; i++) {
+      rule->triggers.push_back(Tag::fromHash(reader.readHash()));
+    }
+    count = reader.readCount(sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; i++) {
+      rule->variants.push_back(reader.readString());
+    }
+    learnedRules.add(ruleName, rule.release());
+  }
+
+  if (!reader.ok) {
+    // Missing, stale, or corrupt.  Learn everything again.
+    learnedRules.clear();
+  }
+}
+
+void ExecPluginActionFactory::saveCache() {
+  SnapshotWriter writer(LEARNED_RULES_MAGIC);
+  for (OwnedPtrMap<std::string, LearnedRule>::Iterator iter(learnedRules); iter.next();) {
+    const LearnedRule* rule = iter.value();
+    writer.writeString(iter.key());
+    writer.writeHash(rule->ruleHash);
+    writer.writeString(rule->verb);
+    writer.writeInt(rule->silent);
+    writer.writeInt(rule->triggers.size());
+    for (const Tag& trigger: rule->triggers) {
+      writer.writeHash(trigger.getHash());
+    }
+    writer.writeInt(rule->variants.size());
+    for (const std::string& variant: rule->variants) {
+      writer.writeString(variant);
+    }
+  }
+  writer.save(cacheFile.get());
+}
+
 // implements ActionFactory --------------------------------------------------------------
 
 void ExecPluginActionFactory::enumerateTriggerTags(
@@ -388,7 +570,23 @@ void ExecPluginActionFactory::enumerateTriggerTags(
 }
 
 OwnedPtr<Action> ExecPluginActionFactory::tryMakeAction(const Tag& id, File* file) {
-  return newOwned<PluginDerivedAction>(file, "learn", false, (File*)NULL);
+  Hash ruleHash = file->contentHash();
+  LearnedRule* rule = learnedRules.get(file->canonicalName());
+  if (rule != nullptr && rule->ruleHash == ruleHash) {
+    return newOwned<LearnedRuleAction>(file, *rule);
+  }
+
+  OwnedPtr<PluginDerivedAction> action =
+      newOwned<PluginDerivedAction>(file, "learn", false, (File*)NULL);
+  action->setLearner(this, ruleHash);
+  return action.release();
+}
+
+std::string ExecPluginActionFactory::getIdentity() {
+  // A learn action runs the rule file that triggered it, so it is determined by that file's
+  // content.  (Learns which register new triggers are never reused by the driver, but e.g.
+  // intercept.ekam-rule just builds something.)
+  return "learn";
 }
 
 }  // namespace ekam
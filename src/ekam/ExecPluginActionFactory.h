@@ -17,18 +17,52 @@
 #ifndef KENTONSCODE_EKAM_EXECPLUGINACTIONFACTORY_H_
 #define KENTONSCODE_EKAM_EXECPLUGINACTIONFACTORY_H_
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include "Action.h"
 
 namespace ekam {
 
 class ExecPluginActionFactory : public ActionFactory {
 public:
-  ExecPluginActionFactory();
+  // Learned rules are cached in `tmp` across runs.
+  explicit ExecPluginActionFactory(File* tmp);
   ~ExecPluginActionFactory();
 
+  // What a rule declared when run with no arguments, if it did nothing else (e.g. didn't look
+  // for any inputs).  Such a rule need not be run again until its content changes.
+  struct LearnedRule {
+    Hash ruleHash;
+    std::string verb;
+    bool silent;
+    std::vector<Tag> triggers;
+    std::vector<std::string> variants;
+  };
+
+  void learned(const std::string& ruleName, OwnedPtr<LearnedRule> rule);
+
+  // Requests that rules (and the programs they run under intercept.so) have sent, over every
+  // rule this process has run.
+  struct RequestStats {
+    uint64_t requests;
+    uint64_t lookups;    // findProvider, findInput, and findModifiers
+    uint64_t cacheHits;  // repeats, answered from the rule's earlier replies
+  };
+  static RequestStats getRequestStats();
+
   // implements ActionFactory ------------------------------------------------------------
   void enumerateTriggerTags(std::back_insert_iterator<std::vector<Tag> > iter);
   OwnedPtr<Action> tryMakeAction(const Tag& id, File* file);
+  std::string getIdentity();
+
+private:
+  OwnedPtr<File> cacheFile;
+  OwnedPtrMap<std::string, LearnedRule> learnedRules;  // by rule's canonical name
+
+  void loadCache();
+  void saveCache();
 };
 
 }  // namespace ekam
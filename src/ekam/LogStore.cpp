@@ -0,0 +1,164 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "LogStore.h"
+
+#include <fcntl.h>
+
+#include "base/Debug.h"
+#include "os/ByteStream.h"
+
+namespace ekam {
+
+const size_t LogStore::TAIL_SIZE;
+
+LogStore::LogStore(File* directory)
+    : directory(directory->clone()), counter(0) {
+  if (this->directory->isDirectory()) {
+    OwnedPtrVector<File> oldLogs;
+    this->directory->list(oldLogs.appender());
+    for (int i = 0; i < oldLogs.size(); i++) {
+      try {
+        oldLogs.get(i)->unlink();
+      } catch (const OsError& error) {
+        DEBUG_ERROR << "Couldn't delete old log: " << error.what();
+      }
+    }
+  } else {
+    recursivelyCreateDirectory(this->directory.get());
+  }
+}
+
+LogStore::~LogStore() {}
+
+// =======================================================================================
+
+LogStore::Log::Log(LogStore* store)
+    : store(store), totalSize(0), tailStart(0) {}
+
+LogStore::Log::~Log() {
+  clear();
+}
+
+void LogStore::Log::append(const std::string& text) {
+  if (store != nullptr && totalSize + text.size() > TAIL_SIZE) {
+    spill(text);
+  }
+  totalSize += text.size();
+
+  if (text.size() >= TAIL_SIZE) {
+    tail.assign(text, text.size() - TAIL_SIZE, TAIL_SIZE);
+    tailStart = 0;
+    return;
+  }
+
+  std::string::size_type pos = 0;
+  if (tail.size() < TAIL_SIZE) {
+    pos = std::min(TAIL_SIZE - tail.size(), text.size());
+    tail.append(text, 0, pos);
+  }
+
+  // Tail is full; overwrite the oldest bytes.
+  while (pos < text.size()) {
+    std::string::size_type n = std::min(TAIL_SIZE - tailStart, text.size() - pos);
+    tail.replace(tailStart, n, text, pos, n);
+    pos += n;
+    tailStart = (tailStart + n) % TAIL_SIZE;
+  }
+}
+
+void LogStore::Log::clear() {
+  deleteSpillFile();
+  totalSize = 0;
+  tail.clear();
+  tailStart = 0;
+}
+
+std::string LogStore::Log::getTail() {
+  if (tailStart == 0) {
+    return tail;
+  } else {
+    return tail.substr(tailStart) + tail.substr(0, tailStart);
+  }
+}
+
+std::string LogStore::Log::readAll() {
+  if (spillFile != nullptr) {
+    try {
+      return spillFile->readAll();
+    } catch (const OsError& error) {
+      DEBUG_ERROR << "Couldn't read log: " << error.what();
+    }
+  }
+  return getTail();
+}
+
+void LogStore::Log::writeTo(FILE* output) {
+  if (spillFile != nullptr) {
+    try {
+      ByteStream stream(spillPath, O_RDONLY | O_CLOEXEC);
+      char buffer[8192];
+      size_t n;
+      while ((n = stream.read(buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, sizeof(char), n, output);
+      }
+      return;
+    } catch (const OsError& error) {
+      DEBUG_ERROR << "Couldn't read log: " << error.what();
+    }
+  }
+
+  std::string text = getTail();
+  fwrite(text.data(), sizeof(char), text.size(), output);
+}
+
+void LogStore::Log::spill(const std::string& text) {
+  try {
+    if (spillFile == nullptr) {
+      // First time over the limit.  Nothing has been dropped from the tail yet, so it holds
+      // everything so far.
+      spillFile = store->directory->relative(toString(++store->counter) + ".log");
+      spillPath = spillFile->getOnDisk(File::WRITE)->path();
+      ByteStream stream(spillPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+      stream.writeAll(tail.data(), tail.size());
+      stream.writeAll(text.data(), text.size());
+    } else {
+      // Don't hold the file open between appends; there could be thousands of these.
+      ByteStream stream(spillPath, O_WRONLY | O_APPEND | O_CLOEXEC);
+      stream.writeAll(text.data(), text.size());
+    }
+  } catch (const OsError& error) {
+    DEBUG_ERROR << "Couldn't save log; keeping only its tail: " << error.what();
+    // Whatever made it into the file is incomplete, so don't leave it lying around.
+    deleteSpillFile();
+    store = nullptr;
+  }
+}
+
+void LogStore::Log::deleteSpillFile() {
+  if (spillFile != nullptr) {
+    try {
+      if (spillFile->exists()) {
+        spillFile->unlink();
+      }
+    } catch (const OsError& error) {
+      DEBUG_ERROR << "Couldn't delete log: " << error.what();
+    }
+    spillFile.clear();
+  }
+}
+
+}  // namespace ekam
@@ -0,0 +1,88 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_EKAM_LOGSTORE_H_
+#define KENTONSCODE_EKAM_LOGSTORE_H_
+
+#include <stdio.h>
+#include <string>
+
+#include "base/OwnedPtr.h"
+#include "os/File.h"
+
+namespace ekam {
+
+// Keeps task logs without letting a verbose task inflate Ekam's memory.  Each log holds only its
+// last TAIL_SIZE bytes in memory.  Once a log outgrows that, the whole thing is spilled to a file
+// in the store's directory, where it stays until the log is cleared or destroyed.
+class LogStore {
+public:
+  // Takes over `directory`, deleting logs left behind by a previous run.
+  explicit LogStore(File* directory);
+  ~LogStore();
+
+  static const size_t TAIL_SIZE = 4096;
+
+  class Log {
+  public:
+    // Without a store, anything before the tail is simply dropped.
+    explicit Log(LogStore* store = nullptr);
+    ~Log();
+
+    void append(const std::string& text);
+    void clear();
+
+    inline bool empty() { return totalSize == 0; }
+
+    // Bytes appended since the log was created or last cleared.
+    inline size_t size() { return totalSize; }
+
+    // True if getTail() is missing the start of the log.
+    inline bool isTruncated() { return totalSize > tail.size(); }
+
+    std::string getTail();
+
+    // True if the whole log is in a spill file.
+    inline bool isSaved() { return spillFile != nullptr; }
+
+    // The whole log, from the spill file if there is one.  If the log was truncated and never
+    // spilled (no store, or the write failed), this is the same as getTail().
+    std::string readAll();
+    void writeTo(FILE* output);
+
+  private:
+    LogStore* store;
+    size_t totalSize;
+
+    // Ring buffer; once it reaches TAIL_SIZE, tailStart is where the oldest byte is.
+    std::string tail;
+    std::string::size_type tailStart;
+
+    OwnedPtr<File> spillFile;  // null if not spilled
+    std::string spillPath;
+
+    void spill(const std::string& text);
+    void deleteSpillFile();
+  };
+
+private:
+  OwnedPtr<File> directory;
+  int counter;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_EKAM_LOGSTORE_H_
@@ -0,0 +1,173 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "LogStore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+
+#include "os/DiskFile.h"
+
+namespace ekam {
+namespace {
+
+#define ASSERT(EXPRESSION)                                                    \
+  if (!(EXPRESSION)) {                                                        \
+    fprintf(stderr, "%s:%d: FAILED: %s\n", __FILE__, __LINE__, #EXPRESSION);  \
+    exit(1);                                                                  \
+  }
+
+const size_t TAIL_SIZE = LogStore::TAIL_SIZE;
+
+// A string of the given size whose bytes depend on their position, so that misplaced bytes
+// show up.
+std::string pattern(size_t size, char seed) {
+  std::string result;
+  for (size_t i = 0; i < size; i++) {
+    result.push_back(seed + i % 23);
+  }
+  return result;
+}
+
+std::string lastBytes(const std::string& text, size_t size) {
+  return text.size() <= size ? text : text.substr(text.size() - size);
+}
+
+int countFiles(File* directory) {
+  OwnedPtrVector<File> files;
+  directory->list(files.appender());
+  return files.size();
+}
+
+std::string readFile(FILE* file) {
+  std::string result;
+  rewind(file);
+  char buffer[1024];
+  size_t n;
+  while ((n = fread(buffer, sizeof(char), sizeof(buffer), file)) > 0) {
+    result.append(buffer, n);
+  }
+  return result;
+}
+
+void testTailWraparound() {
+  // Appends of awkward sizes move tailStart all the way around the ring buffer several times.
+  LogStore::Log log;
+  std::string expected;
+  for (int i = 0; i < 200; i++) {
+    std::string text = pattern(1 + i * 37 % 1000, 'a' + i % 3);
+    log.append(text);
+    expected += text;
+    ASSERT(log.getTail() == lastBytes(expected, TAIL_SIZE));
+    ASSERT(log.isTruncated() == (expected.size() > TAIL_SIZE));
+  }
+
+  ASSERT(!log.isSaved());
+  ASSERT(log.readAll() == log.getTail());
+
+  log.clear();
+  ASSERT(log.empty());
+  ASSERT(log.getTail().empty());
+}
+
+void testLargeAppend() {
+  LogStore::Log log;
+  log.append(pattern(100, 'a'));
+
+  // Replaces the whole tail at once, even though the tail had wrapped.
+  std::string big = pattern(TAIL_SIZE * 2 + 5, 'A');
+  log.append(big);
+  ASSERT(log.getTail() == lastBytes(big, TAIL_SIZE));
+  ASSERT(log.isTruncated());
+
+  std::string expected = pattern(100, 'a') + big;
+  for (int i = 0; i < 3; i++) {
+    std::string text = pattern(1000, '0');
+    log.append(text);
+    expected += text;
+    ASSERT(log.getTail() == lastBytes(expected, TAIL_SIZE));
+  }
+}
+
+void testSpill(File* directory) {
+  LogStore store(directory);
+
+  {
+    LogStore::Log log(&store);
+    std::string expected = pattern(TAIL_SIZE - 10, 'a');
+    log.append(expected);
+    ASSERT(!log.isSaved());
+    ASSERT(countFiles(directory) == 0);
+
+    // The first spill must write what was in the tail before the new text.
+    std::string text = pattern(20, 'A');
+    log.append(text);
+    expected += text;
+    ASSERT(log.isSaved());
+    ASSERT(countFiles(directory) == 1);
+    ASSERT(log.readAll() == expected);
+    ASSERT(log.getTail() == lastBytes(expected, TAIL_SIZE));
+
+    // Later appends, including ones bigger than the tail, go to the end of the file.
+    for (int i = 0; i < 10; i++) {
+      text = pattern(i == 5 ? TAIL_SIZE * 3 : 999, '0' + i);
+      log.append(text);
+      expected += text;
+    }
+    ASSERT(log.readAll() == expected);
+    ASSERT(log.getTail() == lastBytes(expected, TAIL_SIZE));
+
+    FILE* output = tmpfile();
+    ASSERT(output != NULL);
+    log.writeTo(output);
+    ASSERT(readFile(output) == expected);
+    fclose(output);
+
+    log.clear();
+    ASSERT(!log.isSaved());
+    ASSERT(countFiles(directory) == 0);
+
+    // A log that's bigger than the tail from the start spills right away.
+    text = pattern(TAIL_SIZE + 1, 'a');
+    log.append(text);
+    ASSERT(log.isSaved());
+    ASSERT(log.readAll() == text);
+  }
+
+  // Destroying the log deletes its file.
+  ASSERT(countFiles(directory) == 0);
+}
+
+}  // namespace
+}  // namespace ekam
+
+int main(int argc, char* argv[]) {
+  char path[] = "/tmp/ekam-logstore-test.XXXXXX";
+  if (mkdtemp(path) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  ekam::DiskFile directory(path, NULL);
+
+  ekam::testTailWraparound();
+  ekam::testLargeAppend();
+  ekam::testSpill(&directory);
+
+  rmdir(path);
+  return 0;
+}
@@ -0,0 +1,137 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Metrics.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "base/Debug.h"
+
+namespace ekam {
+
+Metrics::Metrics() {}
+Metrics::~Metrics() {}
+
+void Metrics::declare(const std::string& name, Type type, const std::string& help) {
+  static const char* const TYPE_NAMES[] = { "counter", "gauge", "histogram" };
+  text += "# HELP " + name + " " + help + "\n";
+  text += "# TYPE " + name + " " + TYPE_NAMES[type] + "\n";
+}
+
+void Metrics::sample(const std::string& name, double value, const std::string& labels) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.15g", value);
+  text += name;
+  if (!labels.empty()) {
+    text += "{" + labels + "}";
+  }
+  text += " ";
+  text += buffer;
+  text += "\n";
+}
+
+std::string Metrics::label(const char* key, const std::string& value) {
+  std::string result = key;
+  result += "=\"";
+  for (char c: value) {
+    switch (c) {
+      case '\\': result += "\\\\"; break;
+      case '"': result += "\\\""; break;
+      case '\n': result += "\\n"; break;
+      default: result += c; break;
+    }
+  }
+  result += "\"";
+  return result;
+}
+
+void Metrics::counter(const std::string& name, const std::string& help, double value) {
+  declare(name, COUNTER, help);
+  sample(name, value);
+}
+
+void Metrics::gauge(const std::string& name, const std::string& help, double value) {
+  declare(name, GAUGE, help);
+  sample(name, value);
+}
+
+void Metrics::addEventLoop(const EventLoopStats& stats) {
+  counter("ekam_event_loop_callbacks_total", "Callbacks run by the event loop.",
+          stats.callbacksRun);
+  counter("ekam_event_loop_io_events_total",
+          "File descriptor, signal, and inotify events handled by the event loop.",
+          stats.ioEvents);
+  counter("ekam_event_loop_busy_seconds_total",
+          "Time the event loop spent running callbacks and handling events.",
+          stats.busyMicros / 1e6);
+  gauge("ekam_event_loop_queued_callbacks", "Callbacks waiting for the event loop to run them.",
+        stats.queuedCallbacks);
+
+  // Prometheus histogram buckets are cumulative.
+  declare("ekam_event_loop_callback_wait_seconds", HISTOGRAM,
+          "How long callbacks waited for the event loop to get to them.");
+  uint64_t count = 0;
+  for (int i = 0; i < EventLoopStats::WAIT_BUCKET_COUNT; i++) {
+    count += stats.waitHistogram[i];
+    char bound[32];
+    snprintf(bound, sizeof(bound), "%g", EventLoopStats::WAIT_BUCKETS[i] / 1e6);
+    sample("ekam_event_loop_callback_wait_seconds_bucket", count, label("le", bound));
+  }
+  sample("ekam_event_loop_callback_wait_seconds_bucket", stats.callbacksRun,
+         label("le", "+Inf"));
+  sample("ekam_event_loop_callback_wait_seconds_sum", stats.totalWaitMicros / 1e6);
+  sample("ekam_event_loop_callback_wait_seconds_count", stats.callbacksRun);
+}
+
+void Metrics::addProcess() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    ResourceUsage self(usage);
+    declare("ekam_process_cpu_seconds_total", COUNTER, "CPU time used by Ekam itself.");
+    sample("ekam_process_cpu_seconds_total", self.userMicros / 1e6, label("mode", "user"));
+    sample("ekam_process_cpu_seconds_total", self.systemMicros / 1e6, label("mode", "system"));
+    gauge("ekam_process_peak_resident_memory_bytes", "Ekam's peak resident set size.",
+          self.maxRssKb * 1024.0);
+  }
+
+  // The second field of statm is the resident set size, in pages.
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (statm != nullptr) {
+    unsigned long size, resident;
+    if (fscanf(statm, "%lu %lu", &size, &resident) == 2) {
+      gauge("ekam_process_resident_memory_bytes", "Ekam's resident set size.",
+            static_cast<double>(resident) * sysconf(_SC_PAGESIZE));
+    }
+    fclose(statm);
+  }
+}
+
+bool Metrics::save(File* file) {
+  OwnedPtr<File> newFile = file->parent()->relative(file->basename() + ".new");
+  newFile->writeAll(text);
+  if (rename(newFile->getOnDisk(File::READ)->path().c_str(),
+             file->getOnDisk(File::WRITE)->path().c_str()) < 0) {
+    DEBUG_ERROR << "rename(" << file->canonicalName() << "): " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace ekam
@@ -0,0 +1,72 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_EKAM_METRICS_H_
+#define KENTONSCODE_EKAM_METRICS_H_
+
+#include <string>
+
+#include "os/EventManager.h"
+#include "os/File.h"
+
+namespace ekam {
+
+// A page of metrics in the Prometheus text format, e.g. for node_exporter's textfile collector
+// to pick up.  Each part of Ekam adds its own; the values are running totals and current sizes
+// which are cheap to keep as it goes, so a scraper computes rates (e.g. requests per second)
+// itself.
+class Metrics {
+public:
+  Metrics();
+  ~Metrics();
+
+  enum Type {
+    COUNTER,
+    GAUGE,
+    HISTOGRAM
+  };
+
+  // Introduces a metric; the samples that follow belong to it.  Names start with "ekam_", and
+  // counters' names end with "_total".
+  void declare(const std::string& name, Type type, const std::string& help);
+
+  // `name` is the declared name, plus e.g. "_bucket" for a histogram.  `labels` is empty or a
+  // comma-separated list of label()s.
+  void sample(const std::string& name, double value, const std::string& labels = "");
+  static std::string label(const char* key, const std::string& value);
+
+  // An unlabeled metric with a single sample.
+  void counter(const std::string& name, const std::string& help, double value);
+  void gauge(const std::string& name, const std::string& help, double value);
+
+  // The event loop's counters, as ekam_event_loop_*.
+  void addEventLoop(const EventLoopStats& stats);
+
+  // This process's memory and CPU use, as ekam_process_*.
+  void addProcess();
+
+  const std::string& getText() { return text; }
+
+  // Replaces `file` with the metrics all at once, so that a scraper never sees half of them.
+  bool save(File* file);
+
+private:
+  std::string text;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_EKAM_METRICS_H_
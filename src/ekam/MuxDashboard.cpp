@@ -19,6 +19,7 @@
 #include <stdexcept>
 
 #include "base/Debug.h"
+#include "LogStore.h"
 
 namespace ekam {
 
@@ -33,6 +34,7 @@ public:
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
 
 private:
   MuxDashboard* mux;
@@ -40,24 +42,25 @@ private:
   Silence silence;
   std::string verb;
   std::string noun;
-  std::string outputText;
+  LogStore::Log outputLog;  // Shared with wrapped tasks.  Replayed to dashboards attached later.
+  bool hasUsage;            // Likewise.
+  ResourceUsage usage;
 
   typedef OwnedPtrMap<Dashboard*, Task> WrappedTasksMap;
   WrappedTasksMap wrappedTasks;
-
-  static const size_t OUTPUT_BUFER_LIMIT = 4096 - sizeof("\n...(log truncated)...");
 };
 
-const size_t MuxDashboard::TaskImpl::OUTPUT_BUFER_LIMIT;
-
 MuxDashboard::TaskImpl::TaskImpl(MuxDashboard* mux, const std::string& verb,
                                  const std::string& noun, Silence silence)
-    : mux(mux), state(PENDING), silence(silence), verb(verb), noun(noun) {
+    : mux(mux), state(PENDING), silence(silence), verb(verb), noun(noun),
+      outputLog(mux->logStore), hasUsage(false) {
   mux->tasks.insert(this);
 
   for (std::unordered_set<Dashboard*>::iterator iter = mux->wrappedDashboards.begin();
        iter != mux->wrappedDashboards.end(); ++iter) {
-    wrappedTasks.add(*iter, (*iter)->beginTask(verb, noun, silence));
+    OwnedPtr<Task> wrappedTask = (*iter)->beginTask(verb, noun, silence);
+    wrappedTask->setSharedLog(&outputLog);
+    wrappedTasks.add(*iter, wrappedTask.release());
   }
 }
 MuxDashboard::TaskImpl::~TaskImpl() {
@@ -66,8 +69,15 @@ MuxDashboard::TaskImpl::~TaskImpl() {
 
 void MuxDashboard::TaskImpl::attach(Dashboard* dashboard) {
   OwnedPtr<Task> wrappedTask = dashboard->beginTask(verb, noun, silence);
-  if (!outputText.empty()) {
-    wrappedTask->addOutput(outputText);
+  wrappedTask->setSharedLog(&outputLog);
+  if (outputLog.isTruncated()) {
+    wrappedTask->addOutput("...(log truncated)...\n");
+  }
+  if (!outputLog.empty()) {
+    wrappedTask->addOutput(outputLog.getTail());
+  }
+  if (hasUsage) {
+    wrappedTask->setResourceUsage(usage);
   }
   if (state != PENDING) {
     wrappedTask->setState(state);
@@ -86,7 +96,8 @@ void MuxDashboard::TaskImpl::detach(Dashboard* dashboard) {
 
 void MuxDashboard::TaskImpl::setState(TaskState state) {
   if (state == PENDING || state == RUNNING) {
-    outputText.clear();
+    outputLog.clear();
+    hasUsage = false;
   }
 
   this->state = state;
@@ -96,23 +107,25 @@ void MuxDashboard::TaskImpl::setState(TaskState state) {
 }
 
 void MuxDashboard::TaskImpl::addOutput(const std::string& text) {
-  if (outputText.size() < OUTPUT_BUFER_LIMIT) {
-    if (outputText.size() + text.size() < OUTPUT_BUFER_LIMIT) {
-      outputText.append(text);
-    } else {
-      outputText.append(text, 0, OUTPUT_BUFER_LIMIT - outputText.size());
-      outputText.append("\n...(log truncated)...");
-    }
-  }
+  outputLog.append(text);
 
   for (WrappedTasksMap::Iterator iter(wrappedTasks); iter.next();) {
     iter.value()->addOutput(text);
   }
 }
 
+void MuxDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  hasUsage = true;
+  this->usage = usage;
+
+  for (WrappedTasksMap::Iterator iter(wrappedTasks); iter.next();) {
+    iter.value()->setResourceUsage(usage);
+  }
+}
+
 // =======================================================================================
 
-MuxDashboard::MuxDashboard() {}
+MuxDashboard::MuxDashboard(LogStore* logStore) : logStore(logStore) {}
 MuxDashboard::~MuxDashboard() {}
 
 OwnedPtr<Dashboard::Task> MuxDashboard::beginTask(const std::string& verb, const std::string& noun,
@@ -20,12 +20,15 @@
 #include <unordered_set>
 
 #include "Dashboard.h"
+#include "LogStore.h"
 
 namespace ekam {
 
 class MuxDashboard : public Dashboard {
 public:
-  MuxDashboard();
+  // Each task's log is kept here, spilling to `logStore` if it gets long, and shared with the
+  // wrapped dashboards' tasks (see Task::setSharedLog()), which need only keep the tail.
+  explicit MuxDashboard(LogStore* logStore = nullptr);
   ~MuxDashboard();
 
   class Connector {
@@ -44,6 +47,7 @@ public:
 private:
   class TaskImpl;
 
+  LogStore* logStore;
   std::unordered_set<TaskImpl*> tasks;
   std::unordered_set<Dashboard*> wrappedDashboards;
 };
@@ -16,170 +16,590 @@
 
 #include "ProtoDashboard.h"
 
+#include <algorithm>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <capnp/message.h>
 #include <capnp/serialize.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <kj/exception.h>
 
+#include "base/Debug.h"
 #include "dashboard.capnp.h"
 #include "os/Socket.h"
 #include "MuxDashboard.h"
 
 namespace ekam {
 
+static const proto::TaskUpdate::State STATE_CODES[] = {
+  proto::TaskUpdate::State::PENDING,
+  proto::TaskUpdate::State::RUNNING,
+  proto::TaskUpdate::State::DONE   ,
+  proto::TaskUpdate::State::PASSED ,
+  proto::TaskUpdate::State::FAILED ,
+  proto::TaskUpdate::State::BLOCKED
+};
+
 class ProtoDashboard::TaskImpl : public Dashboard::Task {
 public:
-  TaskImpl(int id, const std::string& verb, const std::string& noun,
-           Silence silence, WriteBuffer* output);
+  TaskImpl(ProtoDashboard* dashboard, int id, const std::string& verb, const std::string& noun,
+           Silence silence);
   ~TaskImpl();
 
+  inline int getId() { return id; }
+  inline std::string readFullLog() { return fullLog()->readAll(); }
+
+  // Fill in everything a client needs to know about this task when it first sees it, including
+  // the tail of the log so far.  Used for the header snapshot, too.
+  void snapshot(proto::TaskUpdate::Builder update);
+
+  // Tell the client about this task, or that it's gone, if its subscription has changed.
+  void resync(Client* client);
+
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
+  void setSharedLog(LogStore::Log* log);
 
 private:
+  ProtoDashboard* dashboard;
   int id;
-  WriteBuffer* output;
+  TaskState state;
+  Silence silence;
+  std::string verb;
+  std::string noun;
+  LogStore::Log outputLog;  // just the tail; see fullLog()
+  LogStore::Log* sharedLog;
+  bool hasUsage;
+  ResourceUsage usage;
+
+  LogStore::Log* fullLog();
+
+  inline bool isVisibleTo(Client* client) {
+    return client->subscription.matches(verb, noun, silence, state);
+  }
 
-  static const proto::TaskUpdate::State STATE_CODES[];
+  SmartPtr<EncodedMessage> encodeSnapshot();
+  SmartPtr<EncodedMessage> encodeDeletion();
+  void fillUsage(proto::TaskUpdate::Builder update);
 };
 
-const proto::TaskUpdate::State ProtoDashboard::TaskImpl::STATE_CODES[] = {
-  proto::TaskUpdate::State::PENDING,
-  proto::TaskUpdate::State::RUNNING,
-  proto::TaskUpdate::State::DONE   ,
-  proto::TaskUpdate::State::PASSED ,
-  proto::TaskUpdate::State::FAILED ,
-  proto::TaskUpdate::State::BLOCKED
-};
+ProtoDashboard::TaskImpl::TaskImpl(ProtoDashboard* dashboard, int id, const std::string& verb,
+                                   const std::string& noun, Silence silence)
+    : dashboard(dashboard), id(id), state(PENDING), silence(silence), verb(verb), noun(noun),
+      sharedLog(nullptr), hasUsage(false) {
+  dashboard->tasks[id] = this;
+
+  SmartPtr<EncodedMessage> message;  // encoded only if some client wants it
+  for (OwnedPtrMap<Client*, Client>::Iterator iter(dashboard->clients); iter.next();) {
+    Client* client = iter.value();
+    if (isVisibleTo(client)) {
+      if (message == nullptr) message = encodeSnapshot();
+      client->visibleTasks.insert(id);
+      client->push(message);
+    }
+  }
+  if (message != nullptr) {
+    dashboard->scheduleFlush();
+  }
+}
 
-ProtoDashboard::TaskImpl::TaskImpl(int id, const std::string& verb, const std::string& noun,
-                                   Silence silence, WriteBuffer* output)
-    : id(id), output(output) {
-  capnp::MallocMessageBuilder message;
-  proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
+ProtoDashboard::TaskImpl::~TaskImpl() {
+  dashboard->tasks.erase(id);
+
+  SmartPtr<EncodedMessage> message;
+  for (OwnedPtrMap<Client*, Client>::Iterator iter(dashboard->clients); iter.next();) {
+    Client* client = iter.value();
+    if (client->visibleTasks.erase(id) > 0) {
+      if (message == nullptr) message = encodeDeletion();
+      client->push(message);
+    }
+  }
+  if (message != nullptr) {
+    dashboard->scheduleFlush();
+  }
+}
+
+void ProtoDashboard::TaskImpl::snapshot(proto::TaskUpdate::Builder update) {
   update.setId(id);
-  update.setState(proto::TaskUpdate::State::PENDING);
+  update.setState(STATE_CODES[state]);
   update.setVerb(verb);
   update.setNoun(noun);
   update.setSilent(silence == SILENT);
-  output->write(message.getSegmentsForOutput());
+  fillUsage(update);
+
+  if (outputLog.empty()) {
+    // No log.
+  } else if (!outputLog.isTruncated()) {
+    update.setLog(outputLog.getTail());
+  } else {
+    // Start the tail at a line boundary so that clients parsing the log see whole lines.
+    std::string tail = outputLog.getTail();
+    std::string::size_type eol = tail.find('\n');
+    if (eol != std::string::npos && eol + 1 < tail.size()) {
+      tail.erase(0, eol + 1);
+    }
+    update.setLog(tail);
+    update.setLogIsTail(true);
+  }
 }
 
-ProtoDashboard::TaskImpl::~TaskImpl() {
+SmartPtr<ProtoDashboard::EncodedMessage> ProtoDashboard::TaskImpl::encodeSnapshot() {
+  capnp::MallocMessageBuilder message;
+  snapshot(message.getRoot<proto::TaskUpdate>());
+  return encode(&message, false);
+}
+
+SmartPtr<ProtoDashboard::EncodedMessage> ProtoDashboard::TaskImpl::encodeDeletion() {
   capnp::MallocMessageBuilder message;
   proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
   update.setId(id);
   update.setState(proto::TaskUpdate::State::DELETED);
-  output->write(message.getSegmentsForOutput());
+  return encode(&message, false);
+}
+
+void ProtoDashboard::TaskImpl::fillUsage(proto::TaskUpdate::Builder update) {
+  if (hasUsage) {
+    proto::ResourceUsage::Builder builder = update.initUsage();
+    builder.setUserMicros(usage.userMicros);
+    builder.setSystemMicros(usage.systemMicros);
+    builder.setMaxRssKb(usage.maxRssKb);
+    builder.setBlockInputs(usage.blockInputs);
+    builder.setBlockOutputs(usage.blockOutputs);
+    builder.setVoluntaryContextSwitches(usage.voluntarySwitches);
+    builder.setInvoluntaryContextSwitches(usage.involuntarySwitches);
+  }
+}
+
+void ProtoDashboard::TaskImpl::resync(Client* client) {
+  bool wasVisible = client->visibleTasks.count(id) > 0;
+  if (isVisibleTo(client)) {
+    if (!wasVisible) {
+      client->visibleTasks.insert(id);
+      client->push(encodeSnapshot());
+    }
+  } else if (wasVisible) {
+    client->visibleTasks.erase(id);
+    client->push(encodeDeletion());
+  }
 }
 
 void ProtoDashboard::TaskImpl::setState(TaskState state) {
-  capnp::MallocMessageBuilder message;
-  proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
-  update.setId(id);
-  update.setState(STATE_CODES[state]);
-  output->write(message.getSegmentsForOutput());
+  if (state == PENDING || state == RUNNING) {
+    outputLog.clear();
+    hasUsage = false;
+  }
+  this->state = state;
+
+  // Clients that could already see the task just need the new state.  For others, the task may
+  // have just come into or gone out of view.
+  SmartPtr<EncodedMessage> stateMessage;
+  SmartPtr<EncodedMessage> snapshotMessage;
+  SmartPtr<EncodedMessage> deletionMessage;
+  for (OwnedPtrMap<Client*, Client>::Iterator iter(dashboard->clients); iter.next();) {
+    Client* client = iter.value();
+    bool wasVisible = client->visibleTasks.count(id) > 0;
+    if (!isVisibleTo(client)) {
+      if (wasVisible) {
+        if (deletionMessage == nullptr) deletionMessage = encodeDeletion();
+        client->visibleTasks.erase(id);
+        client->push(deletionMessage);
+      }
+    } else if (wasVisible) {
+      if (stateMessage == nullptr) {
+        capnp::MallocMessageBuilder message;
+        proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
+        update.setId(id);
+        update.setState(STATE_CODES[state]);
+        fillUsage(update);
+        stateMessage = encode(&message, false);
+      }
+      client->push(stateMessage);
+    } else {
+      if (snapshotMessage == nullptr) snapshotMessage = encodeSnapshot();
+      client->visibleTasks.insert(id);
+      client->push(snapshotMessage);
+    }
+  }
+  if (stateMessage != nullptr || snapshotMessage != nullptr || deletionMessage != nullptr) {
+    dashboard->scheduleFlush();
+  }
 }
 
 void ProtoDashboard::TaskImpl::addOutput(const std::string& text) {
-  capnp::MallocMessageBuilder message;
-  proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
-  update.setId(id);
-  update.setLog(text);
-  output->write(message.getSegmentsForOutput());
+  outputLog.append(text);
+
+  SmartPtr<EncodedMessage> logMessage;
+  for (OwnedPtrMap<Client*, Client>::Iterator iter(dashboard->clients); iter.next();) {
+    Client* client = iter.value();
+    if (client->subscription.logs && client->visibleTasks.count(id) > 0) {
+      if (logMessage == nullptr) {
+        capnp::MallocMessageBuilder message;
+        proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
+        update.setId(id);
+        update.setLog(text);
+        logMessage = encode(&message, true);
+      }
+      client->push(logMessage);
+    }
+  }
+  if (logMessage != nullptr) {
+    dashboard->scheduleFlush();
+  }
+}
+
+void ProtoDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  // Clients get it along with the state change that follows.
+  hasUsage = true;
+  this->usage = usage;
+}
+
+void ProtoDashboard::TaskImpl::setSharedLog(LogStore::Log* log) {
+  sharedLog = log;
+}
+
+LogStore::Log* ProtoDashboard::TaskImpl::fullLog() {
+  // Our log is cleared whenever the shared one is, so this only fails if the task was attached
+  // to us after it had already logged something.
+  return sharedLog != nullptr && sharedLog->size() == outputLog.size() ? sharedLog : &outputLog;
+}
+
+// =======================================================================================
+
+bool ProtoDashboard::Subscription::matches(const std::string& verb, const std::string& noun,
+                                           Silence silence, TaskState state) const {
+  if (silence == SILENT && !includeSilent && state != FAILED) {
+    return false;
+  }
+  if ((stateMask & (1u << state)) == 0) {
+    return false;
+  }
+  if (!verbs.empty() && std::find(verbs.begin(), verbs.end(), verb) == verbs.end()) {
+    return false;
+  }
+  if (!nounPrefixes.empty()) {
+    for (const std::string& prefix : nounPrefixes) {
+      if (noun.compare(0, prefix.size(), prefix) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return true;
 }
 
 // =======================================================================================
 
-ProtoDashboard::ProtoDashboard(EventManager* eventManager, OwnedPtr<ByteStream> stream)
-    : idCounter(0),
-      writeBuffer(eventManager, stream.release()) {
+ProtoDashboard::ProtoDashboard(EventManager* eventManager)
+    : eventManager(eventManager), requestHandler(nullptr), idCounter(0) {}
+ProtoDashboard::~ProtoDashboard() {}
+
+void ProtoDashboard::addClient(OwnedPtr<ByteStream> stream) {
+  auto client = newOwned<Client>(this, stream.release());
+
   capnp::MallocMessageBuilder message;
   proto::Header::Builder header = message.getRoot<proto::Header>();
   char* cwd = get_current_dir_name();
   header.setProjectRoot(cwd);
   free(cwd);
-  writeBuffer.write(message.getSegmentsForOutput());
+
+  // New clients haven't subscribed yet, so they see everything.
+  capnp::List<proto::TaskUpdate>::Builder snapshot = header.initTasks(tasks.size());
+  uint i = 0;
+  for (auto& entry : tasks) {
+    entry.second->snapshot(snapshot[i++]);
+    client->visibleTasks.insert(entry.first);
+  }
+  client->push(encode(&message, false));
+
+  auto key = client.get();  // cannot inline due to undefined evaluation order
+  clients.add(key, client.release());
+
+  scheduleFlush();
 }
-ProtoDashboard::~ProtoDashboard() {}
 
 OwnedPtr<Dashboard::Task> ProtoDashboard::beginTask(
     const std::string& verb, const std::string& noun, Silence silence) {
-  return newOwned<TaskImpl>(++idCounter, verb, noun, silence, &writeBuffer);
+  return newOwned<TaskImpl>(this, ++idCounter, verb, noun, silence);
+}
+
+void ProtoDashboard::setRequestHandler(RequestHandler* handler) {
+  requestHandler = handler;
+}
+
+SmartPtr<ProtoDashboard::EncodedMessage> ProtoDashboard::encode(
+    capnp::MessageBuilder* message, bool isLog) {
+  return newOwned<EncodedMessage>(
+      capnp::messageToFlatArray(message->getSegmentsForOutput()), isLog);
+}
+
+void ProtoDashboard::sendFullLog(Client* client, int taskId) {
+  std::unordered_map<int, TaskImpl*>::iterator iter = tasks.find(taskId);
+  if (iter == tasks.end()) {
+    // Already deleted; the client will see (or has seen) the deletion.
+    return;
+  }
+
+  capnp::MallocMessageBuilder message;
+  proto::TaskUpdate::Builder update = message.getRoot<proto::TaskUpdate>();
+  update.setId(taskId);
+  update.setLog(iter->second->readFullLog());
+  update.setLogIsComplete(true);
+
+  // The client asked for this, so don't let the backlog limit drop it.
+  client->push(encode(&message, false));
+  scheduleFlush();
+}
+
+void ProtoDashboard::resync(Client* client) {
+  for (auto& entry : tasks) {
+    entry.second->resync(client);
+  }
+  scheduleFlush();
+}
+
+void ProtoDashboard::scheduleFlush() {
+  // Updates tend to arrive in bursts, so wait for the event loop to come around again and
+  // then write everything queued so far at once.
+  if (flushOp == nullptr) {
+    flushOp = eventManager->when()(
+      [this]() {
+        flushOp.release();
+        flushAll();
+      });
+  }
+}
+
+void ProtoDashboard::flushAll() {
+  for (OwnedPtrMap<Client*, Client>::Iterator iter(clients); iter.next();) {
+    iter.value()->flush();
+    if (!iter.value()->isConnected()) {
+      clients.erase(iter.key());
+    }
+  }
 }
 
 // =======================================================================================
 
-ProtoDashboard::WriteBuffer::WriteBuffer(EventManager* eventManager,
-                                         OwnedPtr<ByteStream> stream)
-    : eventManager(eventManager), stream(stream.release()),
-      ioWatcher(eventManager->watchFd(this->stream->getHandle()->get())),
-      offset(0), disconnectFulfiller(NULL) {}
-ProtoDashboard::WriteBuffer::~WriteBuffer() {}
+// Once a client's unwritten backlog passes this size, it stops receiving log text and gets
+// only state changes until it catches up.
+static const size_t BACKLOG_LOG_LIMIT = 1 << 20;
+
+// A client that can't even keep up with state changes is disconnected.
+static const size_t BACKLOG_LIMIT = 16 << 20;
+
+// Clients only send small requests; anything bigger than this is garbage.
+static const size_t MAX_REQUEST_WORDS = 1 << 16;
+
+ProtoDashboard::Client::Client(ProtoDashboard* dashboard, OwnedPtr<ByteStream> stream)
+    : dashboard(dashboard), stream(stream.release()),
+      ioWatcher(dashboard->eventManager->watchFd(this->stream->getHandle()->get())),
+      offset(0), backlogBytes(0), droppingLogs(false),
+      readBuffer(kj::heapArray<capnp::word>(64)), readBytes(0) {
+  waitForRequests();
+}
+ProtoDashboard::Client::~Client() {}
 
-void ProtoDashboard::WriteBuffer::write(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> message) {
-  if (stream == NULL) {
+void ProtoDashboard::Client::push(const SmartPtr<EncodedMessage>& message) {
+  if (stream == nullptr) {
     // Already disconnected.
     return;
   }
 
-  messages.push(capnp::messageToFlatArray(message));
+  size_t size = message->words.asBytes().size();
+
+  if (backlogBytes == 0) {
+    // Caught up.
+    droppingLogs = false;
+  }
+  if (!droppingLogs && backlogBytes + size > BACKLOG_LOG_LIMIT) {
+    droppingLogs = true;
+    dropQueuedLogs();
+  }
+
+  if (droppingLogs && message->isLog) {
+    return;
+  }
+
+  if (backlogBytes + size > BACKLOG_LIMIT) {
+    DEBUG_ERROR << "Dashboard client is not reading updates; disconnecting.";
+    disconnect();
+    return;
+  }
+
+  messages.push_back(message);
+  backlogBytes += size;
+}
 
-  ready();
+void ProtoDashboard::Client::dropQueuedLogs() {
+  // The front message may be partially written already, so it must stay.
+  std::deque<SmartPtr<EncodedMessage> > kept;
+  for (size_t i = 0; i < messages.size(); i++) {
+    if (i == 0 || !messages[i]->isLog) {
+      kept.push_back(messages[i]);
+    } else {
+      backlogBytes -= messages[i]->words.asBytes().size();
+    }
+  }
+  messages.swap(kept);
 }
 
-void ProtoDashboard::WriteBuffer::ready() {
+void ProtoDashboard::Client::flush() {
+  if (stream == nullptr || waitWritableOp != nullptr) {
+    // Disconnected, or already waiting for the socket to drain.
+    return;
+  }
+
   try {
     while (!messages.empty()) {
-      const kj::Array<capnp::word>& message = messages.front();
-      while (offset < message.size()) {
-        offset += stream->write(message.asBytes().begin() + offset,
-                                message.asBytes().size() - offset);
+      struct iovec pieces[IOV_MAX < 64 ? IOV_MAX : 64];
+      int count = 0;
+      for (size_t i = 0; i < messages.size() && count < int(sizeof(pieces) / sizeof(pieces[0]));
+           i++) {
+        kj::ArrayPtr<const kj::byte> bytes = messages[i]->words.asBytes();
+        size_t skip = i == 0 ? offset : 0;
+        pieces[count].iov_base = const_cast<kj::byte*>(bytes.begin() + skip);
+        pieces[count].iov_len = bytes.size() - skip;
+        ++count;
       }
-      offset = 0;
-      messages.pop();
+
+      size_t written = stream->writev(pieces, count);
+      backlogBytes -= written;
+      written += offset;
+      while (!messages.empty() && written >= messages.front()->words.asBytes().size()) {
+        written -= messages.front()->words.asBytes().size();
+        messages.pop_front();
+      }
+      offset = written;
     }
   } catch (const OsError& error) {
     if (error.getErrorNumber() == EAGAIN) {
       // Ran out of kernel buffer space.  Wait until writable again.
-      waitWritablePromise = eventManager->when(ioWatcher->onWritable())(
+      waitWritableOp = dashboard->eventManager->when(ioWatcher->onWritable())(
         [this](Void) {
-          ready();
+          waitWritableOp.release();
+          flush();
         });
     } else {
-      stream.clear();
-
-      if (disconnectFulfiller != NULL) {
-        disconnectFulfiller->disconnected();
-      }
+      disconnect();
     }
   }
 }
 
-// =======================================================================================
+void ProtoDashboard::Client::waitForRequests() {
+  readOp = dashboard->eventManager->when(ioWatcher->onReadable())(
+    [this](Void) {
+      readOp.release();
+      if (receive()) {
+        waitForRequests();
+      }
+    });
+}
 
-ProtoDashboard::WriteBuffer::DisconnectFulfiller::DisconnectFulfiller(Callback* callback,
-                                                                      WriteBuffer* writeBuffer)
-    : callback(callback), writeBuffer(writeBuffer) {
-  if (writeBuffer->disconnectFulfiller != NULL) {
-    throw std::logic_error("Can only register one disconnect callback at a time.");
+bool ProtoDashboard::Client::receive() {
+  if (readBytes == readBuffer.size() * sizeof(capnp::word)) {
+    if (readBuffer.size() >= MAX_REQUEST_WORDS) {
+      DEBUG_ERROR << "Dashboard client sent an oversized request; disconnecting.";
+      disconnect();
+      return false;
+    }
+    kj::Array<capnp::word> newBuffer = kj::heapArray<capnp::word>(readBuffer.size() * 2);
+    memcpy(newBuffer.begin(), readBuffer.begin(), readBytes);
+    readBuffer = kj::mv(newBuffer);
   }
-  writeBuffer->disconnectFulfiller = this;
-}
 
-ProtoDashboard::WriteBuffer::DisconnectFulfiller::~DisconnectFulfiller() {
-  assert(writeBuffer->disconnectFulfiller == this);
-  writeBuffer->disconnectFulfiller = NULL;
-}
+  try {
+    size_t n = stream->read(reinterpret_cast<kj::byte*>(readBuffer.begin()) + readBytes,
+                            readBuffer.size() * sizeof(capnp::word) - readBytes);
+    if (n == 0) {
+      // Client won't send any more requests, but it may still be listening.
+      return false;
+    }
+    readBytes += n;
+  } catch (const OsError& error) {
+    if (error.getErrorNumber() == EAGAIN) {
+      return true;
+    }
+    disconnect();
+    return false;
+  }
+
+  try {
+    for (;;) {
+      kj::ArrayPtr<const capnp::word> available(readBuffer.begin(),
+                                               readBytes / sizeof(capnp::word));
+      size_t size = capnp::expectedSizeInWordsFromPrefix(available);
+      if (size > available.size()) {
+        // Need more data.  (Grows the buffer next time around if it's full.)
+        break;
+      }
+
+      {
+        capnp::FlatArrayMessageReader reader(available.slice(0, size));
+        proto::ClientMessage::Reader request = reader.getRoot<proto::ClientMessage>();
+        for (uint32_t taskId : request.getFetchLog()) {
+          dashboard->sendFullLog(this, taskId);
+        }
+        if (request.hasSubscribe()) {
+          proto::Subscription::Reader newSubscription = request.getSubscribe();
+          subscription = Subscription();
+          for (capnp::Text::Reader verb : newSubscription.getVerbs()) {
+            subscription.verbs.push_back(std::string(verb.cStr(), verb.size()));
+          }
+          for (capnp::Text::Reader prefix : newSubscription.getNounPrefixes()) {
+            subscription.nounPrefixes.push_back(std::string(prefix.cStr(), prefix.size()));
+          }
+          if (newSubscription.getStates().size() > 0) {
+            subscription.stateMask = 0;
+            for (proto::TaskUpdate::State state : newSubscription.getStates()) {
+              for (unsigned int i = 0; i < sizeof(STATE_CODES) / sizeof(STATE_CODES[0]); i++) {
+                if (STATE_CODES[i] == state) {
+                  subscription.stateMask |= 1u << i;
+                }
+              }
+            }
+          }
+          subscription.includeSilent = newSubscription.getIncludeSilent();
+          subscription.logs = newSubscription.getLogs();
+          dashboard->resync(this);
+        }
+        if (dashboard->requestHandler != nullptr) {
+          for (capnp::Text::Reader name : request.getPrioritize()) {
+            dashboard->requestHandler->prioritize(std::string(name.cStr(), name.size()));
+          }
+        }
+      }
+
+      readBytes -= size * sizeof(capnp::word);
+      memmove(readBuffer.begin(), readBuffer.begin() + size, readBytes);
+    }
+  } catch (const kj::Exception& exception) {
+    DEBUG_ERROR << "Dashboard client sent a malformed request; disconnecting: "
+                << exception.getDescription().cStr();
+    disconnect();
+    return false;
+  }
 
-Promise<void> ProtoDashboard::onDisconnect() {
-  return writeBuffer.onDisconnect();
+  // Handling a request may have overflowed the backlog and disconnected us.
+  return isConnected();
 }
 
-Promise<void> ProtoDashboard::WriteBuffer::onDisconnect() {
-  return newPromise<DisconnectFulfiller>(this);
+void ProtoDashboard::Client::disconnect() {
+  if (readOp != nullptr) {
+    readOp.release();
+  }
+  if (waitWritableOp != nullptr) {
+    waitWritableOp.release();
+  }
+  messages.clear();
+  backlogBytes = 0;
+  offset = 0;
+  ioWatcher.clear();
+  stream.clear();
 }
 
 // =======================================================================================
@@ -187,10 +607,13 @@ Promise<void> ProtoDashboard::WriteBuffer::onDisconnect() {
 class NetworkAcceptingDashboard : public Dashboard {
 public:
   NetworkAcceptingDashboard(EventManager* eventManager, const std::string& address,
-                            OwnedPtr<Dashboard> baseDashboard)
+                            OwnedPtr<Dashboard> baseDashboard, LogStore* logStore)
       : eventManager(eventManager),
         base(baseDashboard.release()),
+        mux(logStore),
         baseConnector(newOwned<MuxDashboard::Connector>(&mux, base.get())),
+        protoDashboard(eventManager),
+        protoConnector(newOwned<MuxDashboard::Connector>(&mux, &protoDashboard)),
         socket(newOwned<ServerSocket>(eventManager, address)),
         acceptOp(doAccept()) {}
   ~NetworkAcceptingDashboard() {}
@@ -198,57 +621,35 @@ public:
   Promise<void> doAccept() {
     return eventManager->when(socket->accept())(
       [this](OwnedPtr<ByteStream> stream){
-        accepted(stream.release());
+        protoDashboard.addClient(stream.release());
         return doAccept();
       });
   }
 
-  void accepted(OwnedPtr<ByteStream> stream);
-
   // implements Dashboard ----------------------------------------------------------------
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence) {
     return mux.beginTask(verb, noun, silence);
   }
+  void setRequestHandler(RequestHandler* handler) {
+    protoDashboard.setRequestHandler(handler);
+  }
 
 private:
   EventManager* eventManager;
   OwnedPtr<Dashboard> base;
   MuxDashboard mux;
   OwnedPtr<MuxDashboard::Connector> baseConnector;
+  ProtoDashboard protoDashboard;
+  OwnedPtr<MuxDashboard::Connector> protoConnector;
   OwnedPtr<ServerSocket> socket;
   Promise<void> acceptOp;
-
-  class ConnectedProtoDashboard {
-  public:
-    ConnectedProtoDashboard(NetworkAcceptingDashboard* owner, EventManager* eventManager,
-                            OwnedPtr<ByteStream> stream)
-        : protoDashboard(eventManager, stream.release()),
-          connector(newOwned<MuxDashboard::Connector>(&owner->mux, &protoDashboard)) {
-      disconnectPromise = eventManager->when(protoDashboard.onDisconnect())(
-        [this, owner](Void) {
-          connector.clear();
-          owner->connectedDashboards.erase(this);
-        });
-    }
-    ~ConnectedProtoDashboard() {}
-
-  private:
-    ProtoDashboard protoDashboard;
-    OwnedPtr<MuxDashboard::Connector> connector;
-    Promise<void> disconnectPromise;
-  };
-  OwnedPtrMap<ConnectedProtoDashboard*, ConnectedProtoDashboard> connectedDashboards;
 };
 
-void NetworkAcceptingDashboard::accepted(OwnedPtr<ByteStream> stream) {
-  auto connectedDashboard = newOwned<ConnectedProtoDashboard>(this, eventManager, stream.release());
-  auto key = connectedDashboard.get();  // cannot inline due to undefined evaluation order
-  connectedDashboards.add(key, connectedDashboard.release());
-}
-
 OwnedPtr<Dashboard> initNetworkDashboard(EventManager* eventManager, const std::string& address,
-                                         OwnedPtr<Dashboard> dashboardToWrap) {
-  return newOwned<NetworkAcceptingDashboard>(eventManager, address, dashboardToWrap.release());
+                                         OwnedPtr<Dashboard> dashboardToWrap,
+                                         LogStore* logStore) {
+  return newOwned<NetworkAcceptingDashboard>(eventManager, address, dashboardToWrap.release(),
+                                             logStore);
 }
 
 }  // namespace ekam
@@ -17,9 +17,14 @@
 #ifndef KENTONSCODE_EKAM_PROTODASHBOARD_H_
 #define KENTONSCODE_EKAM_PROTODASHBOARD_H_
 
-#include <queue>
+#include <deque>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 #include <capnp/common.h>
+#include <capnp/message.h>
+#include <kj/array.h>
 
 #include "Dashboard.h"
 #include "os/ByteStream.h"
@@ -27,53 +32,99 @@
 
 namespace ekam {
 
+// Streams task updates to any number of connected clients.  Each update is serialized once and
+// the encoded bytes are shared by every client's outgoing queue.  Tasks keep only the tail of
+// their logs; a client asking for a whole log gets it from the task's shared log (see
+// Task::setSharedLog()), so run this behind a MuxDashboard with a LogStore.
 class ProtoDashboard : public Dashboard {
 public:
-  ProtoDashboard(EventManager* eventManager, OwnedPtr<ByteStream> stream);
+  explicit ProtoDashboard(EventManager* eventManager);
   ~ProtoDashboard();
 
-  Promise<void> onDisconnect();
+  // Start streaming to a new client.  It first receives a header holding a snapshot of every
+  // live task, then all subsequent updates.  The client may ask for full logs, or narrow down
+  // what it is sent, over the same connection.  It is dropped when it disconnects.
+  void addClient(OwnedPtr<ByteStream> stream);
 
   // implements Dashboard ----------------------------------------------------------------
   OwnedPtr<Task> beginTask(const std::string& verb, const std::string& noun, Silence silence);
+  void setRequestHandler(RequestHandler* handler);
 
 private:
   class TaskImpl;
 
-  class WriteBuffer {
-  public:
-    WriteBuffer(EventManager* eventManager, OwnedPtr<ByteStream> stream);
-    ~WriteBuffer();
+  struct EncodedMessage {
+    EncodedMessage(kj::Array<capnp::word> words, bool isLog)
+        : words(kj::mv(words)), isLog(isLog) {}
 
-    void write(kj::ArrayPtr<const kj::ArrayPtr<const capnp::word>> data);
-    Promise<void> onDisconnect();
+    kj::Array<capnp::word> words;
 
-  private:
-    EventManager* eventManager;
-    OwnedPtr<ByteStream> stream;
-    OwnedPtr<EventManager::IoWatcher> ioWatcher;
-    std::queue<kj::Array<capnp::word>> messages;
-    std::string::size_type offset;
-    Promise<void> waitWritablePromise;
+    // Log text may be dropped for clients that have fallen behind; everything else is delivered.
+    bool isLog;
+  };
+
+  // Mirrors proto::Subscription.  The default matches everything.
+  struct Subscription {
+    Subscription(): stateMask(~0u), includeSilent(true), logs(true) {}
 
-    class DisconnectFulfiller : public PromiseFulfiller<void> {
-    public:
-      DisconnectFulfiller(Callback* callback, WriteBuffer* writeBuffer);
-      ~DisconnectFulfiller();
+    std::vector<std::string> verbs;
+    std::vector<std::string> nounPrefixes;
+    unsigned int stateMask;  // bit (1 << state) for each TaskState
+    bool includeSilent;
+    bool logs;
 
-      void disconnected() { callback->fulfill(); }
+    bool matches(const std::string& verb, const std::string& noun, Silence silence,
+                 TaskState state) const;
+  };
 
-    private:
-      Callback* callback;
-      WriteBuffer* writeBuffer;
-    };
-    DisconnectFulfiller* disconnectFulfiller;
+  class Client {
+  public:
+    Client(ProtoDashboard* dashboard, OwnedPtr<ByteStream> stream);
+    ~Client();
 
-    void ready();
+    inline bool isConnected() { return stream != nullptr; }
+
+    void push(const SmartPtr<EncodedMessage>& message);
+    void flush();
+
+    Subscription subscription;
+
+    // IDs of tasks the client has been told about and not since told were deleted.
+    std::unordered_set<int> visibleTasks;
+
+  private:
+    ProtoDashboard* dashboard;
+    OwnedPtr<ByteStream> stream;
+    OwnedPtr<EventManager::IoWatcher> ioWatcher;
+    std::deque<SmartPtr<EncodedMessage> > messages;
+    size_t offset;        // Bytes of messages.front() already written.
+    size_t backlogBytes;  // Bytes queued but not yet written.
+    bool droppingLogs;
+    Promise<void> waitWritableOp;
+
+    // Incoming ClientMessages, possibly ending with a partial one.
+    kj::Array<capnp::word> readBuffer;
+    size_t readBytes;
+    Promise<void> readOp;
+
+    void dropQueuedLogs();
+    void waitForRequests();
+    bool receive();
+    void disconnect();
   };
 
+  EventManager* eventManager;
+  RequestHandler* requestHandler;
   int idCounter;
-  WriteBuffer writeBuffer;
+  std::unordered_map<int, TaskImpl*> tasks;
+  OwnedPtrMap<Client*, Client> clients;
+  Promise<void> flushOp;
+
+  static SmartPtr<EncodedMessage> encode(capnp::MessageBuilder* message, bool isLog);
+  void sendFullLog(Client* client, int taskId);
+  void resync(Client* client);
+  void scheduleFlush();
+  void flushAll();
 };
 
 }  // namespace ekam
@@ -20,22 +20,30 @@ namespace ekam {
 
 class SimpleDashboard::TaskImpl : public Dashboard::Task {
 public:
-  TaskImpl(const std::string& verb, const std::string& noun, Silence silence, FILE* outputStream);
+  TaskImpl(const std::string& verb, const std::string& noun, Silence silence, FILE* outputStream,
+           LogStore* logStore);
   ~TaskImpl();
 
   // implements Task ---------------------------------------------------------------------
   void setState(TaskState state);
   void addOutput(const std::string& text);
+  void setResourceUsage(const ResourceUsage& usage);
+  void setSharedLog(LogStore::Log* log);
 
 private:
   TaskState state;
   Silence silence;
   std::string verb;
   std::string noun;
-  std::string outputText;
+  LogStore::Log outputLog;
+  LogStore::Log* sharedLog;
   FILE* outputStream;
+  bool hasUsage;
+  ResourceUsage usage;
 
   static const char* const STATE_NAMES[];
+
+  LogStore::Log* fullLog();
 };
 
 const char* const SimpleDashboard::TaskImpl::STATE_NAMES[] = {
@@ -48,32 +56,46 @@ const char* const SimpleDashboard::TaskImpl::STATE_NAMES[] = {
 };
 
 SimpleDashboard::TaskImpl::TaskImpl(const std::string& verb, const std::string& noun,
-                                    Silence silence, FILE* outputStream)
-    : state(PENDING), silence(silence), verb(verb), noun(noun), outputStream(outputStream) {}
+                                    Silence silence, FILE* outputStream, LogStore* logStore)
+    : state(PENDING), silence(silence), verb(verb), noun(noun), outputLog(logStore),
+      sharedLog(nullptr), outputStream(outputStream), hasUsage(false) {}
 SimpleDashboard::TaskImpl::~TaskImpl() {}
 
 void SimpleDashboard::TaskImpl::setState(TaskState state) {
   // If state was previously BLOCKED, and we managed to un-block, then we don't care about the
   // reason why we were blocked, so clear the text.
   if (this->state == BLOCKED && (state == PENDING || state == RUNNING)) {
-    outputText.clear();
+    outputLog.clear();
+  }
+  if (state == PENDING || state == RUNNING) {
+    hasUsage = false;
   }
   this->state = state;
 
-  bool writeOutput = !outputText.empty() && state != BLOCKED;
+  bool writeOutput = !outputLog.empty() && state != BLOCKED;
 
   if (silence != SILENT || writeOutput) {
     // Write status update.
-    fprintf(outputStream, "[%s] %s: %s\n", STATE_NAMES[state], verb.c_str(), noun.c_str());
+    if (hasUsage && state != BLOCKED) {
+      fprintf(outputStream, "[%s] %s: %s (%s)\n", STATE_NAMES[state], verb.c_str(), noun.c_str(),
+              usage.toString().c_str());
+    } else {
+      fprintf(outputStream, "[%s] %s: %s\n", STATE_NAMES[state], verb.c_str(), noun.c_str());
+    }
 
     // Write any output we have buffered, unless new state is BLOCKED in which case we save the
     // output for later.
     if (writeOutput) {
-      fwrite(outputText.c_str(), sizeof(char), outputText.size(), outputStream);
-      if (outputText[outputText.size() - 1] != '\n') {
+      LogStore::Log* log = fullLog();
+      std::string tail = log->getTail();
+      if (log->isTruncated() && !log->isSaved()) {
+        fputs("...(log truncated)...\n", outputStream);
+      }
+      log->writeTo(outputStream);
+      if (tail[tail.size() - 1] != '\n') {
         fputc('\n', outputStream);
       }
-      outputText.clear();
+      outputLog.clear();
     }
 
     fflush(outputStream);
@@ -81,17 +103,33 @@ void SimpleDashboard::TaskImpl::setState(TaskState state) {
 }
 
 void SimpleDashboard::TaskImpl::addOutput(const std::string& text) {
-  outputText.append(text);
+  outputLog.append(text);
+}
+
+void SimpleDashboard::TaskImpl::setResourceUsage(const ResourceUsage& usage) {
+  hasUsage = true;
+  this->usage = usage;
+}
+
+void SimpleDashboard::TaskImpl::setSharedLog(LogStore::Log* log) {
+  sharedLog = log;
+}
+
+LogStore::Log* SimpleDashboard::TaskImpl::fullLog() {
+  // Both logs get the same output, so if they're the same size, they were last cleared at the
+  // same point and hold the same text -- but the shared one may still have the start of it.
+  return sharedLog != nullptr && sharedLog->size() == outputLog.size() ? sharedLog : &outputLog;
 }
 
 // =======================================================================================
 
-SimpleDashboard::SimpleDashboard(FILE* outputStream) : outputStream(outputStream) {}
+SimpleDashboard::SimpleDashboard(FILE* outputStream, LogStore* logStore)
+    : outputStream(outputStream), logStore(logStore) {}
 SimpleDashboard::~SimpleDashboard() {}
 
 OwnedPtr<Dashboard::Task> SimpleDashboard::beginTask(
     const std::string& verb, const std::string& noun, Silence silence) {
-  return newOwned<TaskImpl>(verb, noun, silence, outputStream);
+  return newOwned<TaskImpl>(verb, noun, silence, outputStream, logStore);
 }
 
 }  // namespace ekam
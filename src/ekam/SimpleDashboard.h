@@ -20,12 +20,13 @@
 #include <stdio.h>
 
 #include "Dashboard.h"
+#include "LogStore.h"
 
 namespace ekam {
 
 class SimpleDashboard : public Dashboard {
 public:
-  SimpleDashboard(FILE* outputStream);
+  SimpleDashboard(FILE* outputStream, LogStore* logStore);
   ~SimpleDashboard();
 
   // implements Dashboard ----------------------------------------------------------------
@@ -35,6 +36,7 @@ private:
   class TaskImpl;
 
   FILE* outputStream;
+  LogStore* logStore;
 };
 
 }  // namespace ekam
@@ -0,0 +1,245 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "base/Debug.h"
+#include "os/DiskFile.h"
+
+extern "C" char** environ;
+
+namespace ekam {
+
+namespace {
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+      str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Does the environment variable `name` affect what the standard rules do?  We can't hash the
+// whole environment, since it includes things like terminal session IDs that change with every
+// shell.
+bool affectsBuild(const std::string& name) {
+  if (name == "MAKEFLAGS" || name == "MFLAGS") {
+    // Set by make when it runs us, and varies from run to run (see os/Jobserver.h).
+    return false;
+  }
+  static const char* const SUFFIXES[] = { "PATH", "CC", "CXX", "FLAGS", "LIBS", "PROTOC" };
+  for (const char* suffix: SUFFIXES) {
+    if (endsWith(name, suffix)) {
+      return true;
+    }
+  }
+  return name == "CROSS_TARGETS";
+}
+
+// Where the shell would find `command`, or the empty string if it wouldn't.
+std::string findExecutable(const std::string& command) {
+  if (command.find('/') != std::string::npos) {
+    return command;
+  }
+  const char* searchPath = getenv("PATH");
+  if (searchPath == NULL) {
+    return std::string();
+  }
+  std::string dirs = searchPath;
+  std::string::size_type pos = 0;
+  while (true) {
+    std::string::size_type end = dirs.find(':', pos);
+    std::string dir = dirs.substr(pos, end - pos);
+    std::string candidate = (dir.empty() ? "." : dir) + "/" + command;
+    struct stat stats;
+    if (stat(candidate.c_str(), &stats) == 0 && S_ISREG(stats.st_mode) &&
+        access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+    pos = end + 1;
+  }
+  return std::string();
+}
+
+Hash computeEnvironmentHash() {
+  std::vector<std::string> variables;
+  for (char** var = environ; *var != NULL; ++var) {
+    std::string variable(*var);
+    if (affectsBuild(variable.substr(0, variable.find('=')))) {
+      variables.push_back(variable);
+    }
+  }
+  std::sort(variables.begin(), variables.end());
+
+  Hash::Builder builder;
+  for (const std::string& variable: variables) {
+    builder.add(variable);
+    builder.add(std::string(1, '\0'));
+  }
+
+  // The compilers the standard rules run (see compile.ekam-rule and CppActionFactory), which
+  // may be upgraded without any variable changing.  The programs they run in turn and the
+  // headers they read are noted by each action instead (see BuildContext::noteInput()), but
+  // the compilers themselves are run directly, and the linker isn't intercepted at all.
+  static const char* const COMPILERS[][2] = { { "CXX", "c++" }, { "CC", "cc" } };
+  for (const auto& compiler: COMPILERS) {
+    const char* value = getenv(compiler[0]);
+    std::string command = value == NULL || *value == '\0' ? compiler[1] : value;
+    std::string path = findExecutable(command.substr(0, command.find(' ')));
+    builder.add(path);
+    builder.add(std::string(1, '\0'));
+    if (!path.empty()) {
+      // Follows symlinks, e.g. through /etc/alternatives, to the binary itself.
+      builder.add(DiskFile(path, NULL).contentHash().toString());
+    }
+  }
+  return builder.build();
+}
+
+// The environment can't change while we run, and hashing the compilers takes a moment.
+Hash environmentHash() {
+  static const Hash result = computeEnvironmentHash();
+  return result;
+}
+
+}  // namespace
+
+SnapshotWriter::SnapshotWriter(const char (&magic)[8]) {
+  data.append(magic, sizeof(magic));
+  writeHash(environmentHash());
+}
+SnapshotWriter::~SnapshotWriter() {}
+
+void SnapshotWriter::writeInt(uint32_t value) {
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void SnapshotWriter::writeString(const std::string& value) {
+  writeInt(value.size());
+  data.append(value);
+}
+
+void SnapshotWriter::writeHash(const Hash& hash) {
+  data.append(reinterpret_cast<const char*>(hash.bytes()), Hash::SIZE);
+}
+
+bool SnapshotWriter::save(File* file) {
+  OwnedPtr<File> newFile = file->parent()->relative(file->basename() + ".new");
+  newFile->writeAll(data);
+  if (rename(newFile->getOnDisk(File::READ)->path().c_str(),
+             file->getOnDisk(File::WRITE)->path().c_str()) < 0) {
+    DEBUG_ERROR << "rename(" << file->canonicalName() << "): " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+// -------------------------------------------------------------------
+
+SnapshotReader::SnapshotReader(File* file, const char (&magic)[8])
+    : ok(false), mapping(MAP_FAILED), size(0), pos(NULL), end(NULL) {
+  if (!file->isFile()) {
+    return;
+  }
+  OwnedPtr<File::DiskRef> diskRef = file->getOnDisk(File::READ);
+
+  int fd = open(diskRef->path().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    DEBUG_ERROR << diskRef->path() << ": open: " << strerror(errno);
+    return;
+  }
+  struct stat stats;
+  if (fstat(fd, &stats) < 0 || stats.st_size == 0) {
+    close(fd);
+    return;
+  }
+  mapping = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    DEBUG_ERROR << diskRef->path() << ": mmap: " << strerror(errno);
+    return;
+  }
+
+  size = stats.st_size;
+  pos = reinterpret_cast<const char*>(mapping);
+  end = pos + size;
+  ok = true;
+
+  const char* actualMagic = read(sizeof(magic));
+  if (actualMagic == NULL || memcmp(actualMagic, magic, sizeof(magic)) != 0 ||
+      readHash() != environmentHash()) {
+    ok = false;
+  }
+}
+
+SnapshotReader::~SnapshotReader() {
+  if (mapping != MAP_FAILED) {
+    munmap(mapping, size);
+  }
+}
+
+const char* SnapshotReader::read(size_t size) {
+  if (!ok || size > static_cast<size_t>(end - pos)) {
+    ok = false;
+    return NULL;
+  }
+  const char* result = pos;
+  pos += size;
+  return result;
+}
+
+uint32_t SnapshotReader::readInt() {
+  uint32_t result = 0;
+  const char* bytes = read(sizeof(result));
+  if (bytes != NULL) {
+    memcpy(&result, bytes, sizeof(result));
+  }
+  return result;
+}
+
+uint32_t SnapshotReader::readCount(size_t minSize) {
+  uint32_t result = readInt();
+  if (result > static_cast<size_t>(end - pos) / minSize) {
+    ok = false;
+    return 0;
+  }
+  return result;
+}
+
+std::string SnapshotReader::readString() {
+  uint32_t size = readInt();
+  const char* bytes = read(size);
+  return bytes == NULL ? std::string() : std::string(bytes, size);
+}
+
+Hash SnapshotReader::readHash() {
+  const char* bytes = read(Hash::SIZE);
+  return bytes == NULL ? Hash::NULL_HASH : Hash::fromBytes(bytes);
+}
+
+}  // namespace ekam
@@ -0,0 +1,81 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_EKAM_SNAPSHOT_H_
+#define KENTONSCODE_EKAM_SNAPSHOT_H_
+
+#include <string>
+#include <stdint.h>
+
+#include "base/Hash.h"
+#include "os/File.h"
+
+namespace ekam {
+
+// Files in tmp which carry state from one Ekam process to the next.  Each begins with an
+// eight-byte magic number identifying the kind of file and its format version, followed by a
+// hash of the parts of the environment that rules look at and of the compilers they run, since
+// they may behave differently in a different environment.  A reader that finds any mismatch or corruption should discard
+// the whole file; the worst that can cost is a full build.
+
+class SnapshotWriter {
+public:
+  explicit SnapshotWriter(const char (&magic)[8]);
+  ~SnapshotWriter();
+
+  void writeInt(uint32_t value);
+  void writeString(const std::string& value);
+  void writeHash(const Hash& hash);
+
+  // Writes a new file and renames it over `file`, so that a crash can't leave a partial
+  // snapshot behind.  Returns false (after logging) on failure.
+  bool save(File* file);
+
+private:
+  std::string data;
+};
+
+// Reads what SnapshotWriter wrote.  Reading past the end returns zeros and clears `ok`, so
+// callers need only check `ok` once they're done.  A missing file reads as empty, with `ok`
+// false.
+class SnapshotReader {
+public:
+  SnapshotReader(File* file, const char (&magic)[8]);
+  ~SnapshotReader();
+
+  bool ok;
+
+  bool atEnd() { return pos == end; }
+
+  uint32_t readInt();
+  // For counts of things which each take at least `minSize` bytes, so that a corrupt count
+  // can't make us allocate huge amounts of memory.
+  uint32_t readCount(size_t minSize);
+  std::string readString();
+  Hash readHash();
+
+private:
+  void* mapping;
+  size_t size;
+  const char* pos;
+  const char* end;
+
+  const char* read(size_t size);
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_EKAM_SNAPSHOT_H_
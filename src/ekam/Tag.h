@@ -41,6 +41,12 @@ public:
 
   static Tag fromFile(const std::string& path);
 
+  // For storing tags on disk.
+  static inline Tag fromHash(const Hash& hash) {
+    return Tag(hash);
+  }
+  inline const Hash& getHash() const { return hash; }
+
   inline std::string toString() { return hash.toString(); }
 
   inline bool operator==(const Tag& other) const { return hash == other.hash; }
@@ -66,8 +72,10 @@ private:
 #ifdef EXTRA_DEBUG
   std::string name;
   inline explicit Tag(const std::string& name) : hash(Hash::of(name)), name(name) {}
+  inline explicit Tag(const Hash& hash) : hash(hash), name(hash.toString()) {}
 #else
   inline explicit Tag(const std::string& name) : hash(Hash::of(name)) {}
+  inline explicit Tag(const Hash& hash) : hash(hash) {}
 #endif
 };
 
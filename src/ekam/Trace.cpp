@@ -0,0 +1,167 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Trace.h"
+
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ekam {
+
+namespace {
+
+uint64_t monotonicMicros() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+void appendJsonString(std::string* out, const std::string& text) {
+  out->push_back('"');
+  for (char c: text) {
+    switch (c) {
+      case '"': out->append("\\\""); break;
+      case '\\': out->append("\\\\"); break;
+      case '\n': out->append("\\n"); break;
+      case '\t': out->append("\\t"); break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escape[8];
+          sprintf(escape, "\\u%04x", c);
+          out->append(escape);
+        } else {
+          out->push_back(c);
+        }
+        break;
+    }
+  }
+  out->push_back('"');
+}
+
+}  // namespace
+
+const int Trace::EVENT_LOOP_TRACK;
+
+Trace::Args& Trace::Args::add(const char* key, const std::string& value) {
+  if (!json.empty()) json.push_back(',');
+  appendJsonString(&json, key);
+  json.push_back(':');
+  appendJsonString(&json, value);
+  return *this;
+}
+
+Trace::Args& Trace::Args::add(const char* key, long long value) {
+  if (!json.empty()) json.push_back(',');
+  appendJsonString(&json, key);
+  json.push_back(':');
+  json.append(std::to_string(value));
+  return *this;
+}
+
+Trace::Trace(FILE* out)
+    : out(out), startTime(monotonicMicros()), pid(getpid()), first(true), spanCounter(0) {
+  fputs("[\n", out);
+  tracksInUse.push_back(true);  // EVENT_LOOP_TRACK
+  nameTrack(EVENT_LOOP_TRACK, "event loop");
+}
+
+Trace::~Trace() {
+  fputs("\n]\n", out);
+  fflush(out);
+}
+
+uint64_t Trace::now() {
+  return monotonicMicros() - startTime;
+}
+
+int Trace::acquireTrack() {
+  for (size_t i = 0; i < tracksInUse.size(); i++) {
+    if (!tracksInUse[i]) {
+      tracksInUse[i] = true;
+      return i;
+    }
+  }
+  int track = tracksInUse.size();
+  tracksInUse.push_back(true);
+  nameTrack(track, "slot " + std::to_string(track));
+  return track;
+}
+
+void Trace::releaseTrack(int track) {
+  tracksInUse[track] = false;
+}
+
+void Trace::complete(int track, const char* category, const std::string& name, uint64_t start,
+                     const Args& args) {
+  uint64_t end = now();
+  beginEvent('X', category, name, track, start);
+  fprintf(out, ",\"dur\":%" PRIu64, end - start);
+  endEvent(args);
+}
+
+void Trace::instant(int track, const char* category, const std::string& name,
+                    const Args& args) {
+  beginEvent('i', category, name, track, now());
+  fputs(",\"s\":\"t\"", out);
+  endEvent(args);
+}
+
+void Trace::span(const char* category, const std::string& name, uint64_t start, uint64_t end,
+                 const Args& args) {
+  // Async events; a begin/end pair is matched up by its ID.
+  uint64_t id = ++spanCounter;
+  beginEvent('b', category, name, EVENT_LOOP_TRACK, start);
+  fprintf(out, ",\"id\":%" PRIu64, id);
+  endEvent(args);
+  beginEvent('e', category, name, EVENT_LOOP_TRACK, end);
+  fprintf(out, ",\"id\":%" PRIu64, id);
+  endEvent(Args());
+}
+
+void Trace::flush() {
+  fflush(out);
+}
+
+void Trace::beginEvent(char phase, const char* category, const std::string& name, int track,
+                       uint64_t time) {
+  std::string header;
+  header.append(first ? "{\"name\":" : ",\n{\"name\":");
+  appendJsonString(&header, name);
+  header.append(",\"cat\":");
+  appendJsonString(&header, category);
+  fputs(header.c_str(), out);
+  fprintf(out, ",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":%d,\"tid\":%d",
+          phase, time, pid, track);
+  first = false;
+}
+
+void Trace::endEvent(const Args& args) {
+  if (!args.json.empty()) {
+    fprintf(out, ",\"args\":{%s}", args.json.c_str());
+  }
+  fputs("}", out);
+}
+
+void Trace::nameTrack(int track, const std::string& name) {
+  // Metadata events, which viewers use to label and order tracks.
+  beginEvent('M', "__metadata", "thread_name", track, 0);
+  endEvent(Args().add("name", name));
+  beginEvent('M', "__metadata", "thread_sort_index", track, 0);
+  endEvent(Args().add("sort_index", track));
+}
+
+}  // namespace ekam
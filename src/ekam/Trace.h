@@ -0,0 +1,89 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_EKAM_TRACE_H_
+#define KENTONSCODE_EKAM_TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace ekam {
+
+// Records a timeline of the build in Chrome's trace event format, for viewing in Perfetto
+// (ui.perfetto.dev) or chrome://tracing.  Events are written out as they happen.  Both viewers
+// accept a file with the closing bracket missing, so a trace of an Ekam that was killed (e.g.
+// in continuous mode) is still readable.
+//
+// Events are laid out on tracks:  track 0 is the event loop itself, and each action that runs
+// a process gets a track for as long as it runs, numbered like slots in a job pool.
+class Trace {
+public:
+  // Writes to `out`, which must outlive the Trace.
+  explicit Trace(FILE* out);
+  ~Trace();
+
+  static const int EVENT_LOOP_TRACK = 0;
+
+  // Arguments attached to an event, shown when it is selected.
+  class Args {
+  public:
+    Args& add(const char* key, const std::string& value);
+    Args& add(const char* key, long long value);
+
+  private:
+    std::string json;
+    friend class Trace;
+  };
+
+  // Microseconds since the trace began.
+  uint64_t now();
+
+  // Lowest-numbered track not already taken by a running action.
+  int acquireTrack();
+  void releaseTrack(int track);
+
+  // An event running from `start` until now.
+  void complete(int track, const char* category, const std::string& name, uint64_t start,
+                const Args& args = Args());
+  void instant(int track, const char* category, const std::string& name,
+               const Args& args = Args());
+
+  // An event running from `start` to `end` on a track of its own, e.g. time spent queued.
+  // Viewers group these by name.
+  void span(const char* category, const std::string& name, uint64_t start, uint64_t end,
+            const Args& args = Args());
+
+  void flush();
+
+private:
+  FILE* out;
+  uint64_t startTime;
+  int pid;
+  bool first;
+  std::vector<bool> tracksInUse;
+  uint64_t spanCounter;
+
+  void beginEvent(char phase, const char* category, const std::string& name, int track,
+                  uint64_t time);
+  void endEvent(const Args& args);
+  void nameTrack(int track, const std::string& name);
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_EKAM_TRACE_H_
@@ -46,6 +46,11 @@ void dump(proto::TaskUpdate::Reader message) {
   if (message.getSilent()) {
     cout << " (silent)";
   }
+  if (message.hasUsage()) {
+    auto usage = message.getUsage();
+    cout << " (" << usage.getUserMicros() << "us user, " << usage.getSystemMicros()
+         << "us sys, " << usage.getMaxRssKb() << "KB peak)";
+  }
   cout << '\n';
 
   if (message.hasLog()) {
@@ -78,6 +83,18 @@ Dashboard::TaskState toDashboardState(proto::TaskUpdate::State state) {
   }
 }
 
+ResourceUsage toResourceUsage(proto::ResourceUsage::Reader usage) {
+  ResourceUsage result;
+  result.userMicros = usage.getUserMicros();
+  result.systemMicros = usage.getSystemMicros();
+  result.maxRssKb = usage.getMaxRssKb();
+  result.blockInputs = usage.getBlockInputs();
+  result.blockOutputs = usage.getBlockOutputs();
+  result.voluntarySwitches = usage.getVoluntaryContextSwitches();
+  result.involuntarySwitches = usage.getInvoluntaryContextSwitches();
+  return result;
+}
+
 int main(int argc, char* argv[]) {
   int maxDisplayedLogLines = 30;
   
@@ -111,25 +128,19 @@ int main(int argc, char* argv[]) {
   kj::FdInputStream rawInput(STDIN_FILENO);
   kj::BufferedInputStreamWrapper bufferedInput(rawInput);
 
-  {
-    capnp::InputStreamMessageReader message(bufferedInput);
-    proto::Header::Reader header = message.getRoot<proto::Header>();
-    printf("Project root: %s\n", header.getProjectRoot().cStr());
-  }
-
-  ConsoleDashboard dashboard(stdout, maxDisplayedLogLines);
+  ConsoleDashboard dashboard(nullptr, stdout, maxDisplayedLogLines);
   OwnedPtrMap<int, Dashboard::Task> tasks;
 
-  while (bufferedInput.tryGetReadBuffer() != nullptr) {
-    capnp::InputStreamMessageReader messageReader(bufferedInput);
-    proto::TaskUpdate::Reader message = messageReader.getRoot<proto::TaskUpdate>();
-
+  auto applyUpdate = [&](proto::TaskUpdate::Reader message) {
     if (message.getState() == proto::TaskUpdate::State::DELETED) {
       tasks.erase(message.getId());
     } else if (Dashboard::Task* task = tasks.get(message.getId())) {
       if (message.hasLog()) {
         task->addOutput(message.getLog());
       }
+      if (message.hasUsage()) {
+        task->setResourceUsage(toResourceUsage(message.getUsage()));
+      }
       if (message.getState() != proto::TaskUpdate::State::UNCHANGED) {
         task->setState(toDashboardState(message.getState()));
       }
@@ -137,15 +148,37 @@ int main(int argc, char* argv[]) {
       OwnedPtr<Dashboard::Task> newTask = dashboard.beginTask(
           message.getVerb(), message.getNoun(),
           message.getSilent() ? Dashboard::SILENT : Dashboard::NORMAL);
+      if (message.getLogIsTail()) {
+        newTask->addOutput("...(log truncated)...\n");
+      }
       if (message.hasLog()) {
         newTask->addOutput(message.getLog());
       }
+      if (message.hasUsage()) {
+        newTask->setResourceUsage(toResourceUsage(message.getUsage()));
+      }
       if (message.getState() != proto::TaskUpdate::State::UNCHANGED &&
           message.getState() != proto::TaskUpdate::State::PENDING) {
         newTask->setState(toDashboardState(message.getState()));
       }
       tasks.add(message.getId(), newTask.release());
     }
+  };
+
+  {
+    capnp::InputStreamMessageReader message(bufferedInput);
+    proto::Header::Reader header = message.getRoot<proto::Header>();
+    printf("Project root: %s\n", header.getProjectRoot().cStr());
+    fflush(stdout);
+
+    for (proto::TaskUpdate::Reader task : header.getTasks()) {
+      applyUpdate(task);
+    }
+  }
+
+  while (bufferedInput.tryGetReadBuffer() != nullptr) {
+    capnp::InputStreamMessageReader messageReader(bufferedInput);
+    applyUpdate(messageReader.getRoot<proto::TaskUpdate>());
   }
 
   return 0;
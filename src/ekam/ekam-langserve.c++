@@ -188,10 +188,11 @@ public:
 
   Diagnostic& add(Diagnostic&& diagnostic) {
     auto& result = diagnostics.findOrCreate(diagnostic, [&]() {
-      dirtySet.add(this);
       return DiagnosticEntry { kj::heap(kj::mv(diagnostic)), 0 };
     });
-    ++result.refcount;
+    if (result.refcount++ == 0 || result.stale) {
+      markDirty();
+    }
     result.stale = false;
     return *result.diagnostic;
   }
@@ -200,9 +201,25 @@ public:
     auto& entry = KJ_ASSERT_NONNULL(diagnostics.find(diagnostic));
     KJ_ASSERT(entry.diagnostic.get() == &diagnostic);
     if (--entry.refcount == 0) {
-      diagnostics.erase(entry);
-      dirtySet.add(this);
+      if (entry.published) {
+        // Keep the entry until the next publish, so that if a rebuild reports the same
+        // diagnostic again before then, the editor never sees it go away.
+        markDirty();
+      } else {
+        diagnostics.erase(entry);
+      }
+    }
+  }
+
+  bool hasUnpublishedChanges() {
+    // Files commonly end up dirty without their diagnostics actually changing, e.g. when a
+    // task is rebuilt and reports the same errors again. Those needn't be republished.
+    for (auto& entry: diagnostics) {
+      bool live = entry.isLive();
+      if (live != entry.published) return true;
+      if (live && entry.notesHash() != entry.publishedNotesHash) return true;
     }
+    return false;
   }
 
   void exportDiagnostics(kj::StringPtr uriPrefix,
@@ -211,13 +228,13 @@ public:
 
     size_t count = 0;
     for (auto& diagnostic: diagnostics) {
-      if (!diagnostic.stale) ++count;
+      if (diagnostic.isLive()) ++count;
     }
 
     auto list = builder.initDiagnostics(count);
     auto iter = diagnostics.begin();
     for (auto out: list) {
-      while (iter->stale) ++iter;
+      while (!iter->isLive()) ++iter;
       auto& in = *(iter++)->diagnostic;
 
       out.setSeverity((uint)in.severity);
@@ -238,6 +255,17 @@ public:
         }
       }
     }
+
+    // Remember what the editor now has, and drop entries it no longer needs.
+    kj::Vector<Diagnostic*> dead;
+    for (auto& entry: diagnostics) {
+      entry.published = entry.isLive();
+      entry.publishedNotesHash = entry.published ? entry.notesHash() : 0;
+      if (entry.refcount == 0) dead.add(entry.diagnostic.get());
+    }
+    for (auto diagnostic: dead) {
+      diagnostics.erase(KJ_ASSERT_NONNULL(diagnostics.find(*diagnostic)));
+    }
   }
 
 private:
@@ -249,6 +277,19 @@ private:
     uint refcount;
     bool stale = false;
 
+    // Whether the last publish included this diagnostic, and with which notes.
+    bool published = false;
+    uint publishedNotesHash = 0;
+
+    bool isLive() const { return refcount > 0 && !stale; }
+    uint notesHash() const {
+      uint result = diagnostic->notes.size();
+      for (auto& note: diagnostic->notes) {
+        result = result * 31 + note.hashCode();
+      }
+      return result;
+    }
+
     bool operator==(const Diagnostic& other) const { return *diagnostic == other; }
     bool operator==(const DiagnosticEntry& other) const { return *diagnostic == *other.diagnostic; }
     uint hashCode() const { return kj::hashCode(*diagnostic); }
@@ -448,108 +489,130 @@ public:
         update.getState() == proto::TaskUpdate::State::RUNNING ||
         update.getState() == proto::TaskUpdate::State::DELETED) {
       clearDiagnostics();
+      partialLine.clear();
     }
-
-    kj::StringPtr log = update.getLog();
-
-    kj::String ownLog;
-    if (leftoverLog.size() > 0) {
-      ownLog = kj::str(leftoverLog, log);
-      log = ownLog;
+    if (update.getLogIsComplete()) {
+      // The full log we asked for; it replaces whatever we've parsed so far.
+      clearDiagnostics();
+      partialLine.clear();
     }
 
+    // Only the newly-appended chunk is scanned. A line split across chunks is carried in
+    // `partialLine` until its end arrives.
+    kj::StringPtr log = update.getLog();
     for (;;) {
-      kj::StringPtr line;
-      kj::String ownLine;
       KJ_IF_MAYBE(eol, log.findFirst('\n')) {
-        ownLine = kj::str(log.slice(0, *eol));
-        line = ownLine;
+        if (partialLine.empty()) {
+          parseLine(log.slice(0, *eol), files);
+        } else {
+          partialLine.addAll(log.slice(0, *eol));
+          parseLine(partialLine.asPtr(), files);
+          partialLine.clear();
+        }
         log = log.slice(*eol + 1);
       } else {
-        leftoverLog = kj::str(log);
+        partialLine.addAll(log);
         break;
       }
+    }
+  }
 
-      trimLeadingSpace(line);
-      if (line == nullptr) continue;
+private:
+  kj::Vector<Diagnostic*> diagnostics;
+  kj::Vector<char> partialLine;
+  bool addNotesToBack = false;
 
-      static constexpr kj::StringPtr IGNORE_PREFIXES[] = {
-        "In file included from "_kj
-      };
-      bool ignore = false;
-      for (auto prefix: IGNORE_PREFIXES) {
-        if (line.startsWith(prefix)) {
-          ignore = true;
+  void parseLine(kj::ArrayPtr<const char> text, SourceFileSet& files) {
+    while (text.size() > 0 && text[0] == ' ') text = text.slice(1, text.size());
+    if (text.size() == 0) return;
+
+    {
+      // Every line we can use starts with a word ending in ':' (a "file:line:column:" or a
+      // linker's "/usr/bin/ld:"). Most of a build log doesn't, so check before copying it.
+      size_t spaceAt = text.size();
+      for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == ' ') {
+          spaceAt = i;
           break;
         }
       }
-      if (ignore) continue;
+      if (text[spaceAt - 1] != ':') return;
+    }
 
-      static constexpr kj::StringPtr STRIP_PREFIXES[] = {
-        // Linker errors start with this.
-        "/usr/bin/ld: "_kj
-      };
-      for (auto prefix: STRIP_PREFIXES) {
-        if (line.startsWith(prefix)) {
-          line = line.slice(prefix.size());
-        }
+    auto ownLine = kj::heapString(text);
+    kj::StringPtr line = ownLine;
+
+    static constexpr kj::StringPtr IGNORE_PREFIXES[] = {
+      "In file included from "_kj
+    };
+    bool ignore = false;
+    for (auto prefix: IGNORE_PREFIXES) {
+      if (line.startsWith(prefix)) {
+        ignore = true;
+        break;
       }
+    }
+    if (ignore) return;
 
-      size_t spaceAt = line.findFirst(' ').orDefault(line.size());
-      if (line[spaceAt - 1] != ':') {
-        // No file:line:column: to parse... skip.
-        continue;
+    static constexpr kj::StringPtr STRIP_PREFIXES[] = {
+      // Linker errors start with this.
+      "/usr/bin/ld: "_kj
+    };
+    for (auto prefix: STRIP_PREFIXES) {
+      if (line.startsWith(prefix)) {
+        line = line.slice(prefix.size());
       }
+    }
 
-      // parse file:line:column:
-      size_t pos = KJ_ASSERT_NONNULL(line.findFirst(':'));
-      auto filename = kj::str(line.slice(0, pos));
-      KJ_IF_MAYBE(file, files.get(filename)) {
-        line = line.slice(pos + 1);
+    size_t spaceAt = line.findFirst(' ').orDefault(line.size());
+    if (spaceAt == 0 || line[spaceAt - 1] != ':') {
+      // No file:line:column: to parse... skip.
+      return;
+    }
 
-        kj::Maybe<uint> lineNo = tryConsumeNumberColon(line);
-        kj::Maybe<ColumnRange> columnRange = tryConsumeRangeColon(line);
+    // parse file:line:column:
+    size_t pos = KJ_ASSERT_NONNULL(line.findFirst(':'));
+    auto filename = kj::str(line.slice(0, pos));
+    KJ_IF_MAYBE(file, files.get(filename)) {
+      line = line.slice(pos + 1);
 
-        trimLeadingSpace(line);
+      kj::Maybe<uint> lineNo = tryConsumeNumberColon(line);
+      kj::Maybe<ColumnRange> columnRange = tryConsumeRangeColon(line);
 
-        Severity severity = consumeSeverity(line);
+      trimLeadingSpace(line);
 
-        Message message {
-          file,
-          lineNo.orDefault(0),
-          columnRange.map([](ColumnRange c) { return c.start; }).orDefault(0),
-          columnRange.map([](ColumnRange c) { return c.end; }).orDefault(0),
-          kj::str(line)
-        };
+      Severity severity = consumeSeverity(line);
 
-        if (severity == Severity::NOTE) {
-          // Append note to previous diagnostic.
-          if (addNotesToBack) {
-            diagnostics.back()->notes.add(kj::mv(message));
-            diagnostics.back()->message.file->markDirty();
-          }
-        } else {
-          Diagnostic diagnostic {
-            severity, kj::mv(message), {}
-          };
-          diagnostics.add(&file->add(kj::mv(diagnostic)));
-
-          // If the notes aren't empty, then this must be a dupe diagnostic, and we don't want to
-          // add duplicate notes.
-          addNotesToBack = diagnostics.back()->notes.empty();
+      Message message {
+        file,
+        lineNo.orDefault(0),
+        columnRange.map([](ColumnRange c) { return c.start; }).orDefault(0),
+        columnRange.map([](ColumnRange c) { return c.end; }).orDefault(0),
+        kj::str(line)
+      };
+
+      if (severity == Severity::NOTE) {
+        // Append note to previous diagnostic.
+        if (addNotesToBack) {
+          diagnostics.back()->notes.add(kj::mv(message));
+          diagnostics.back()->message.file->markDirty();
         }
       } else {
-        // Doesn't appear to start with a filename. Skip.
-        continue;
+        Diagnostic diagnostic {
+          severity, kj::mv(message), {}
+        };
+        diagnostics.add(&file->add(kj::mv(diagnostic)));
+
+        // If the notes aren't empty, then this must be a dupe diagnostic, and we don't want to
+        // add duplicate notes.
+        addNotesToBack = diagnostics.back()->notes.empty();
       }
+    } else {
+      // Doesn't appear to start with a filename. Skip.
+      return;
     }
   }
 
-private:
-  kj::Vector<Diagnostic*> diagnostics;
-  kj::String leftoverLog;
-  bool addNotesToBack = false;
-
   void clearDiagnostics() {
     for (auto diagnostic: diagnostics) {
       diagnostic->message.file->remove(*diagnostic);
@@ -559,6 +622,40 @@ private:
   }
 };
 
+class EkamRequestQueue {
+  // Sends ClientMessages to Ekam one at a time.  Requests come both from the loop reading
+  // Ekam's updates and from editor notifications, which may arrive mid-write.
+public:
+  explicit EkamRequestQueue(kj::AsyncOutputStream& stream): stream(stream) {}
+  KJ_DISALLOW_COPY(EkamRequestQueue);
+
+  void send(kj::Own<capnp::MallocMessageBuilder> message) {
+    auto& ref = *message;
+    queue = queue.then([this, &ref]() {
+      return capnp::writeMessage(stream, ref);
+    }).attach(kj::mv(message)).eagerlyEvaluate([](kj::Exception&& exception) {
+      // If Ekam went away, the read loop will notice and reconnect.
+    });
+  }
+
+private:
+  kj::AsyncOutputStream& stream;
+  kj::Promise<void> queue = kj::READY_NOW;
+};
+
+kj::Maybe<kj::String> uriToCanonicalName(kj::StringPtr uriPrefix, kj::StringPtr uri) {
+  // Ekam names source files relative to `src` (or `tmp`, for generated ones).
+  if (!uri.startsWith(uriPrefix)) return nullptr;
+  auto path = kj::decodeUriComponent(uri.slice(uriPrefix.size()));
+  static constexpr kj::StringPtr DIRS[] = {"src/"_kj, "tmp/"_kj};
+  for (auto dir: DIRS) {
+    if (path.startsWith(dir)) {
+      return kj::str(path.slice(dir.size()));
+    }
+  }
+  return kj::mv(path);
+}
+
 class LanguageServerImpl final: public lsp::LanguageServer::Server {
 public:
   LanguageServerImpl(kj::Own<kj::PromiseFulfiller<void>> initializedFulfiller)
@@ -567,8 +664,9 @@ public:
 
   class Scope {
   public:
-    Scope(LanguageServerImpl& server, SourceFileSet& files, kj::StringPtr uriPrefix)
-        : server(server), files(files), uriPrefix(uriPrefix) {
+    Scope(LanguageServerImpl& server, SourceFileSet& files, kj::StringPtr uriPrefix,
+          EkamRequestQueue& requests)
+        : server(server), files(files), uriPrefix(uriPrefix), requests(requests) {
       server.scope = this;
     }
     ~Scope() noexcept(false) {
@@ -579,6 +677,15 @@ public:
     LanguageServerImpl& server;
     SourceFileSet& files;
     kj::StringPtr uriPrefix;
+    EkamRequestQueue& requests;
+
+    void prioritize(kj::StringPtr uri) {
+      KJ_IF_MAYBE(name, uriToCanonicalName(uriPrefix, uri)) {
+        auto request = kj::heap<capnp::MallocMessageBuilder>();
+        request->getRoot<proto::ClientMessage>().initPrioritize(1).set(0, *name);
+        requests.send(kj::mv(request));
+      }
+    }
 
     friend class LanguageServerImpl;
   };
@@ -600,11 +707,26 @@ protected:
   }
 
   kj::Promise<void> didOpen(DidOpenContext context) override {
-    // Ignore.
+    // Ask Ekam to get to this file ahead of the rest of the build, so that its diagnostics
+    // show up quickly.
+    auto uri = context.getParams().getTextDocument().getUri();
+    openFiles.add(kj::str(uri));
+    KJ_IF_MAYBE(s, scope) {
+      s->prioritize(uri);
+    }
     return kj::READY_NOW;
   }
   kj::Promise<void> didClose(DidCloseContext context) override {
-    // Ignore.
+    auto uri = context.getParams().getTextDocument().getUri();
+    for (auto i: kj::indices(openFiles)) {
+      if (openFiles[i] == uri) {
+        if (i + 1 < openFiles.size()) {
+          openFiles[i] = kj::mv(openFiles.back());
+        }
+        openFiles.removeLast();
+        break;
+      }
+    }
     return kj::READY_NOW;
   }
   kj::Promise<void> didChange(DidChangeContext context) override {
@@ -621,17 +743,28 @@ protected:
     return kj::READY_NOW;
   }
   kj::Promise<void> didSave(DidSaveContext context) override {
-    // Ignore for now.
+    // Ekam will notice the change itself, but may be busy with a long rebuild.
     // TODO(someday): Start a new location map for this file and interpret future diagnostics
     //   against that map rather than the current one.
+    KJ_IF_MAYBE(s, scope) {
+      s->prioritize(context.getParams().getTextDocument().getUri());
+    }
     return kj::READY_NOW;
   }
 
+public:
+  kj::ArrayPtr<const kj::String> getOpenFiles() { return openFiles; }
+
 private:
   kj::Own<kj::PromiseFulfiller<void>> initializedFulfiller;
   kj::Maybe<Scope&> scope;
+  kj::Vector<kj::String> openFiles;  // URIs
 };
 
+// How long to collect changes before publishing. While Ekam is rebuilding many files, this
+// turns a stream of updates into one publish per affected file per window.
+static constexpr kj::Duration PUBLISH_DELAY = 100 * kj::MILLISECONDS;
+
 class LanguageServerMain {
 public:
   LanguageServerMain(kj::ProcessContext& context): context(context) {}
@@ -694,9 +827,9 @@ public:
 
       // Read first message from Ekam.
       kj::String homeUri;
+      auto headerMessage = capnp::readMessage(*ekamConnection).wait(io.waitScope);
+      auto header = headerMessage->getRoot<proto::Header>();
       auto projectHome = ({
-        auto message = capnp::readMessage(*ekamConnection).wait(io.waitScope);
-        auto header = message->getRoot<proto::Header>();
         auto path = kj::str(header.getProjectRoot());
         homeUri = kj::str("file://", path, '/');
         KJ_ASSERT(path.startsWith("/"));
@@ -707,8 +840,49 @@ public:
       SourceFileSet files(*projectHome, dirtySet);
       kj::HashMap<uint, kj::Own<Task>> tasks;
 
-      LanguageServerImpl::Scope serverScope(server, files, homeUri);
-      kj::Promise<void> updateLoopTask = updateLoop(dirtySet, client, homeUri);
+      // The header carries only the tail of each task's log, which may have lost the
+      // diagnostics we care about.  Ask for the full logs of tasks that have finished.
+      kj::Vector<uint> needFullLog;
+      for (auto update: header.getTasks()) {
+        tasks.insert(update.getId(), kj::heap<Task>(update, files))
+            .value->update(update, files);
+        if (update.getLogIsTail() &&
+            update.getState() != proto::TaskUpdate::State::PENDING &&
+            update.getState() != proto::TaskUpdate::State::RUNNING) {
+          needFullLog.add(update.getId());
+        }
+      }
+      EkamRequestQueue requests(*ekamConnection);
+      {
+        // Diagnostics only come from finished or blocked tasks (a blocked compile may already
+        // have reported errors), so don't have Ekam stream anything else (in particular, logs
+        // of tasks still running).
+        auto request = kj::heap<capnp::MallocMessageBuilder>();
+        auto root = request->getRoot<proto::ClientMessage>();
+        root.setFetchLog(needFullLog.asPtr());
+        auto states = root.initSubscribe().initStates(4);
+        states.set(0, proto::TaskUpdate::State::DONE);
+        states.set(1, proto::TaskUpdate::State::PASSED);
+        states.set(2, proto::TaskUpdate::State::FAILED);
+        states.set(3, proto::TaskUpdate::State::BLOCKED);
+
+        kj::Vector<kj::String> openNames;
+        for (auto& uri: server.getOpenFiles()) {
+          KJ_IF_MAYBE(name, uriToCanonicalName(homeUri, uri)) {
+            openNames.add(kj::mv(*name));
+          }
+        }
+        auto prioritize = root.initPrioritize(openNames.size());
+        for (auto i: kj::indices(openNames)) {
+          prioritize.set(i, openNames[i]);
+        }
+        requests.send(kj::mv(request));
+      }
+      headerMessage = nullptr;
+
+      LanguageServerImpl::Scope serverScope(server, files, homeUri, requests);
+      kj::Promise<void> updateLoopTask =
+          updateLoop(dirtySet, io.provider->getTimer(), client, homeUri);
 
       for (;;) {
         kj::Own<capnp::MessageReader> message;
@@ -724,6 +898,13 @@ public:
         }
         auto update = message->getRoot<proto::TaskUpdate>();
 
+        if (update.getLogIsTail()) {
+          // Task just finished and came into view with only the end of its log.
+          auto request = kj::heap<capnp::MallocMessageBuilder>();
+          request->getRoot<proto::ClientMessage>().initFetchLog(1).set(0, update.getId());
+          requests.send(kj::mv(request));
+        }
+
         if (update.getState() == proto::TaskUpdate::State::DELETED) {
           tasks.erase(update.getId());
         } else {
@@ -746,22 +927,23 @@ public:
 private:
   kj::ProcessContext& context;
 
-  kj::Promise<void> updateLoop(DirtySet& dirtySet,
+  kj::Promise<void> updateLoop(DirtySet& dirtySet, kj::Timer& timer,
       lsp::LanguageClient::Client client, kj::StringPtr homeUri) {
     KJ_IF_MAYBE(p, dirtySet.whenNonEmpty()) {
-      return p->then([]() {
+      return p->then([&timer]() {
         // Delay for other messages.
-        return kj::evalLast([]() {});
+        return timer.afterDelay(PUBLISH_DELAY);
       }).then([&dirtySet, client, homeUri]() mutable {
         kj::Vector<kj::Promise<void>> promises;
         dirtySet.forEach([&](SourceFile& file) {
+          if (!file.hasUnpublishedChanges()) return;
           auto req = client.publishDiagnosticsRequest();
           file.exportDiagnostics(homeUri, req);
           promises.add(req.send().ignoreResult());
         });
         return kj::joinPromises(promises.releaseAsArray());
-      }).then([this, &dirtySet, client, homeUri]() mutable {
-        return updateLoop(dirtySet, kj::mv(client), homeUri);
+      }).then([this, &dirtySet, &timer, client, homeUri]() mutable {
+        return updateLoop(dirtySet, timer, kj::mv(client), homeUri);
       });
     } else {
       return kj::READY_NOW;
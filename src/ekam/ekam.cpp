@@ -15,11 +15,15 @@
 // limitations under the License.
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <ctype.h>
+#include <limits.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
@@ -34,9 +38,12 @@
 #include "Action.h"
 #include "SimpleDashboard.h"
 #include "ConsoleDashboard.h"
+#include "LogStore.h"
 #include "CppActionFactory.h"
 #include "ExecPluginActionFactory.h"
 #include "os/OsHandle.h"
+#include "os/Jobserver.h"
+#include "os/Timer.h"
 
 namespace ekam {
 
@@ -47,6 +54,7 @@ public:
 
   // implements Action -------------------------------------------------------------------
   bool isSilent() { return true; }
+  bool isInProcess() { return true; }
   std::string getVerb() { return "scan"; }
 
   Promise<void> start(EventManager* eventManager, BuildContext* context) {
@@ -98,17 +106,70 @@ public:
   }
 };
 
+struct VerbLimit {
+  std::string verb;
+  int limit;
+  bool isPercent;
+};
+
+bool parseVerbLimit(const char* text, VerbLimit* result) {
+  const char* eq = strchr(text, '=');
+  if (eq == NULL || eq == text) return false;
+
+  // strtol() would accept a sign or leading whitespace; a limit is just digits.
+  if (!isdigit(static_cast<unsigned char>(eq[1]))) return false;
+
+  char* endptr;
+  errno = 0;
+  long limit = strtol(eq + 1, &endptr, 10);
+  if (errno == ERANGE || limit <= 0 || limit > INT_MAX) return false;
+
+  result->verb.assign(text, eq);
+  result->limit = limit;
+  result->isPercent = *endptr == '%';
+  if (result->isPercent) {
+    // More than all of -j means nothing, and would overflow when multiplied out.
+    if (limit > 100) return false;
+    ++endptr;
+  }
+  return *endptr == '\0';
+}
+
+std::string targetToCanonicalName(const std::string& target) {
+  if (target.compare(0, 2, "//") == 0) {
+    return target.substr(2);
+  } else if (target == "src") {
+    return std::string();
+  } else if (target.compare(0, 4, "src/") == 0) {
+    return target.substr(4);
+  } else {
+    return target;
+  }
+}
+
 void usage(const char* command, FILE* out) {
   fprintf(out,
-    "usage: %s [-hvc] [-j <jobcount>] [-n [<addr>]:<port>] [-l <count>]\n"
+    "usage: %s [-hvcmf] [-j <jobcount>] [-p <verb>=<limit>] [-n [<addr>]:<port>]\n"
+    "       [-l <count>] [-t <file>] [-M <seconds>] [<target>...]\n"
     "\n"
     "Build code with Ekam. See https://github.io/sandstorm-io/ekam for details.\n"
     "\n"
+    "If targets are given, only build those and whatever they turn out to need,\n"
+    "rather than everything. A target is a file or directory, e.g. `src/foo/` or\n"
+    "`//foo/bar_test`, where `//` stands for `src/`.\n"
+    "\n"
     "options:\n"
     "  -c            Run in continuous mode: when there is nothing left to build,\n"
     "                don't exit, but instead watch the source files for changes\n"
     "                and rebuild as necessary.\n"
     "  -j <jobcount> Run up to <jobcount> actions in parallel.\n"
+    "  -p <verb>=<limit>  Run at most <limit> actions with the given verb (e.g.\n"
+    "                `link`, `test`) in parallel. <limit> may be a count or a\n"
+    "                percentage of <jobcount>, e.g. `-p test=50%%`. May be\n"
+    "                repeated for different verbs.\n"
+    "  -m            Act as a GNU make jobserver, so that tools run by rules which\n"
+    "                support it (make, cargo, etc.) share the <jobcount> limit\n"
+    "                with Ekam rather than each running their own jobs on top.\n"
     "  -n [<addr>]:<port>  Accept network connections on the given address/port\n"
     "                and give real-time build status and logs to anyone who\n"
     "                connects. This enables e.g. `ekam-client` and various IDE\n"
@@ -119,6 +180,18 @@ void usage(const char* command, FILE* out) {
     "                to see more of a particular error log. NOTE: If you just\n"
     "                need a one-off, you can use `ekam-client` rather than\n"
     "                restarting Ekam.\n"
+    "  -t <file>     Write a timeline of the build to <file>: when each action\n"
+    "                was queued and run, in which slot, and where Ekam itself\n"
+    "                spent time. The file is in Chrome's trace event format; open\n"
+    "                it in Perfetto (ui.perfetto.dev) or chrome://tracing.\n"
+    "  -M <seconds>  While building, write metrics to tmp/.ekam-metrics every\n"
+    "                <seconds>, and once more when the build is done. The file is\n"
+    "                in Prometheus text format, e.g. for node_exporter's textfile\n"
+    "                collector.\n"
+    "  -f            Run every action, rather than reusing the outcome of an\n"
+    "                earlier identical run (recorded in tmp/.ekam-snapshot). Use\n"
+    "                this if you suspect a change Ekam can't see, e.g. to a system\n"
+    "                library. The new outcomes are recorded for next time.\n"
     "  -h            See this help\n"
     "  -v            Show debug logs.\n",
     command);
@@ -409,6 +482,74 @@ private:
   }
 };
 
+// Writes tmp/.ekam-metrics every so often while the driver is busy, and once more when it goes
+// idle.  Nothing changes while it's idle, and a pending timer would keep a non-continuous Ekam
+// from exiting.  Passes activity on to `next`.
+class MetricsReporter final: public Driver::ActivityObserver {
+public:
+  MetricsReporter(RunnableEventManager* eventManager, File* tmp, long intervalMs,
+                  Driver::ActivityObserver* next)
+      : eventManager(eventManager), file(tmp->relative(".ekam-metrics")),
+        intervalMs(intervalMs), next(next), timer(eventManager) {}
+
+  // The driver takes the reporter as its observer, so it must be constructed first.
+  void setDriver(Driver* driver) {
+    this->driver = driver;
+  }
+
+  void startingAction() override {
+    if (tickOp == nullptr) {
+      scheduleTick();
+    }
+    next->startingAction();
+  }
+
+  void idle(bool hasFailures) override {
+    if (tickOp != nullptr) {
+      tickOp.release();
+    }
+    write();
+    next->idle(hasFailures);
+  }
+
+private:
+  RunnableEventManager* eventManager;
+  OwnedPtr<File> file;
+  long intervalMs;
+  Driver::ActivityObserver* next;
+  Driver* driver = nullptr;
+  Timer timer;
+  Promise<void> tickOp;
+
+  void scheduleTick() {
+    tickOp = eventManager->when(timer.after(intervalMs))(
+      [this](Void) {
+        tickOp.release();
+        write();
+        scheduleTick();
+      });
+  }
+
+  void write() {
+    Metrics metrics;
+    driver->writeMetrics(&metrics);
+
+    ExecPluginActionFactory::RequestStats requests = ExecPluginActionFactory::getRequestStats();
+    metrics.counter("ekam_rule_requests_total",
+                    "Requests from rules and the tools they run under intercept.so.",
+                    requests.requests);
+    metrics.counter("ekam_rule_lookups_total", "findProvider, findInput, and findModifiers "
+                    "requests from rules.", requests.lookups);
+    metrics.counter("ekam_rule_request_cache_hits_total",
+                    "Rule requests answered from an earlier identical request.",
+                    requests.cacheHits);
+
+    metrics.addEventLoop(eventManager->getStats());
+    metrics.addProcess();
+    metrics.save(file.get());
+  }
+};
+
 // =======================================================================================
 
 void scanSourceTree(File* src, Driver* driver) {
@@ -433,9 +574,10 @@ void scanSourceTree(File* src, Driver* driver) {
   }
 }
 
-OwnedPtr<Dashboard> getDashboard(int maxDisplayedLogLines) {
+OwnedPtr<Dashboard> getDashboard(EventManager* eventManager, LogStore* logStore,
+                                 int maxDisplayedLogLines) {
   if (!isatty(STDOUT_FILENO)) {
-    return newOwned<SimpleDashboard>(stdout);
+    return newOwned<SimpleDashboard>(stdout, logStore);
   }
 
   // Sanity check: make sure the window size is non-zero; otherwise something
@@ -449,16 +591,16 @@ OwnedPtr<Dashboard> getDashboard(int maxDisplayedLogLines) {
     DEBUG_WARNING
       << "Error querying terminal size: " << msg << "; "
       << "falling back to simple output.";
-    return newOwned<SimpleDashboard>(stdout);
+    return newOwned<SimpleDashboard>(stdout, logStore);
   }
   if(windowSize.ws_row == 0 || windowSize.ws_col == 0) {
     DEBUG_WARNING
       << "Terminal size looks suspicious "
       << "(rows = " << windowSize.ws_row << ", columns = " << windowSize.ws_col << "); "
       << "falling back to simple output.";
-    return newOwned<SimpleDashboard>(stdout);
+    return newOwned<SimpleDashboard>(stdout, logStore);
   }
-  return newOwned<ConsoleDashboard>(stdout, maxDisplayedLogLines);
+  return newOwned<ConsoleDashboard>(eventManager, stdout, maxDisplayedLogLines);
 }
 
 int main(int argc, char* argv[]) {
@@ -468,10 +610,15 @@ int main(int argc, char* argv[]) {
   const char* command = argv[0];
   int maxConcurrentActions = 1;
   bool continuous = false;
+  bool useJobserver = false;
+  bool replay = true;
   std::string networkDashboardAddress;
+  std::vector<VerbLimit> verbLimits;
+  const char* traceFilename = nullptr;
+  long metricsIntervalMs = 0;
 
   while (true) {
-    int opt = getopt(argc, argv, "chvj:n:l:");
+    int opt = getopt(argc, argv, "chvmfj:p:n:l:t:M:");
     if (opt == -1) break;
 
     switch (opt) {
@@ -487,15 +634,43 @@ int main(int argc, char* argv[]) {
         }
         break;
       }
+      case 'p': {
+        VerbLimit verbLimit;
+        if (!parseVerbLimit(optarg, &verbLimit)) {
+          fprintf(stderr, "Expected <verb>=<count> or <verb>=<percent>%% after -p.\n");
+          return 1;
+        }
+        verbLimits.push_back(verbLimit);
+        break;
+      }
       case 'h':
         usage(command, stdout);
         return 0;
       case 'c':
         continuous = true;
         break;
+      case 'm':
+        useJobserver = true;
+        break;
+      case 'f':
+        replay = false;
+        break;
       case 'n':
         networkDashboardAddress = optarg;
         break;
+      case 't':
+        traceFilename = optarg;
+        break;
+      case 'M': {
+        char* endptr;
+        double seconds = strtod(optarg, &endptr);
+        if (*endptr != '\0' || !(seconds > 0)) {
+          fprintf(stderr, "Expected a positive number of seconds after -M.\n");
+          return 1;
+        }
+        metricsIntervalMs = std::max(static_cast<long>(seconds * 1000), 1L);
+        break;
+      }
       case 'l': {
         char* endptr;
         maxDisplayedLogLines = strtoul(optarg, &endptr, 0);
@@ -514,11 +689,6 @@ int main(int argc, char* argv[]) {
   argc -= optind;
   argv += optind;
 
-  if (argc > 0) {
-    fprintf(stderr, "%s: unknown argument -- %s\n", command, argv[0]);
-    return 1;
-  }
-
   DiskFile src("src", NULL);
   DiskFile tmp("tmp", NULL);
   DiskFile bin("bin", NULL);
@@ -545,14 +715,72 @@ int main(int argc, char* argv[]) {
 
   OwnedPtr<RunnableEventManager> eventManager = newPreferredEventManager();
 
-  OwnedPtr<Dashboard> dashboard = getDashboard(maxDisplayedLogLines);
+  // With the network dashboard, the console dashboard gets each task's whole log from the
+  // network dashboard's mux (see Dashboard::Task::setSharedLog()), so only the mux spills it.
+  LogStore logStore(tmp.relative(".ekam-logs").get());
+  OwnedPtr<Dashboard> dashboard = getDashboard(
+      eventManager.get(), networkDashboardAddress.empty() ? &logStore : nullptr,
+      maxDisplayedLogLines);
   if (!networkDashboardAddress.empty()) {
     dashboard = initNetworkDashboard(eventManager.get(), networkDashboardAddress,
-                                     dashboard.release());
+                                     dashboard.release(), &logStore);
+  }
+
+  OwnedPtr<Jobserver> jobserver;
+  if (useJobserver) {
+    try {
+      jobserver = newOwned<Jobserver>(maxConcurrentActions - 1);
+      jobserver->exportToEnvironment(maxConcurrentActions);
+    } catch (const OsError& e) {
+      fprintf(stderr, "WARNING: Couldn't create jobserver: %s\n", e.what());
+    }
+  }
+
+  FILE* traceFile = nullptr;
+  OwnedPtr<Trace> trace;
+  if (traceFilename != nullptr) {
+    traceFile = fopen(traceFilename, "w");
+    if (traceFile == nullptr) {
+      fprintf(stderr, "%s: %s\n", traceFilename, strerror(errno));
+      return 1;
+    }
+    trace = newOwned<Trace>(traceFile);
+  }
+
+  OwnedPtr<MetricsReporter> metricsReporter;
+  Driver::ActivityObserver* activityObserver = &locks;
+  if (metricsIntervalMs > 0) {
+    metricsReporter = newOwned<MetricsReporter>(eventManager.get(), &tmp, metricsIntervalMs,
+                                                &locks);
+    activityObserver = metricsReporter.get();
   }
 
   Driver driver(eventManager.get(), dashboard.get(), &tmp, installDirs, maxConcurrentActions,
-                &locks);
+                activityObserver);
+  if (metricsReporter != nullptr) {
+    metricsReporter->setDriver(&driver);
+  }
+  if (jobserver != nullptr) {
+    driver.setJobserver(jobserver.get());
+  }
+  if (trace != nullptr) {
+    driver.setTrace(trace.get());
+  }
+  if (!replay) {
+    driver.disableReplay();
+  }
+
+  for (int i = 0; i < argc; i++) {
+    driver.addTarget(targetToCanonicalName(argv[i]));
+  }
+
+  for (auto& verbLimit: verbLimits) {
+    int limit = verbLimit.limit;
+    if (verbLimit.isPercent) limit = maxConcurrentActions * limit / 100;
+    // A limit of zero would mean the verb's actions never run, which is never what anyone
+    // wants.
+    driver.setVerbLimit(verbLimit.verb, std::max(limit, 1));
+  }
 
   ExtractTypeActionFactory extractTypeActionFactcory;
   driver.addActionFactory(&extractTypeActionFactcory);
@@ -560,7 +788,7 @@ int main(int argc, char* argv[]) {
   CppActionFactory cppActionFactory;
   driver.addActionFactory(&cppActionFactory);
 
-  ExecPluginActionFactory execPluginActionFactory;
+  ExecPluginActionFactory execPluginActionFactory(&tmp);
   driver.addActionFactory(&execPluginActionFactory);
 
   OwnedPtr<DirectoryWatcher> rootWatcher;
@@ -570,6 +798,7 @@ int main(int argc, char* argv[]) {
   } else {
     scanSourceTree(&src, &driver);
   }
+  driver.finishedInitialScan();
   eventManager->loop();
 
   // For debugging purposes, check for zombie processes.
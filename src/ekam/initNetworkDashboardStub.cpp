@@ -20,7 +20,8 @@
 namespace ekam {
 
 OwnedPtr<Dashboard> initNetworkDashboard(EventManager* eventManager, const std::string& address,
-                                         OwnedPtr<Dashboard> dashboardToWrap) {
+                                         OwnedPtr<Dashboard> dashboardToWrap,
+                                         LogStore* logStore) {
   throw std::logic_error("Network dashboard support not compiled in.");
 }
 
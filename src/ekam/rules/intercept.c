@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <pthread.h>
 
 #if __linux__
@@ -168,6 +169,57 @@ static void init_streams() {
   dynamic_pthread_once(&init_once_control, &init_streams_once);
 }
 
+/* When several processes share one connection to Ekam (e.g. the shards of a test), the rule
+ * names a lock file in EKAM_INTERCEPT_LOCK, and each request/response exchange holds it so
+ * that no process can read another's response.  The file is opened per-process because flock()
+ * locks belong to the open file description, which fork() would share. */
+static int shared_lock_fd = -1;
+static pid_t shared_lock_pid = 0;
+
+static int use_shared_lock() {
+  const char* path;
+  static open_t* real_open;
+
+  if (shared_lock_pid == getpid()) return shared_lock_fd >= 0;
+  shared_lock_pid = getpid();
+
+  path = getenv("EKAM_INTERCEPT_LOCK");
+  if (path == NULL || *path == '\0') {
+    shared_lock_fd = -1;
+    return 0;
+  }
+
+  if (real_open == NULL) {
+    real_open = (open_t*) dlsym(RTLD_NEXT, "open");
+    assert(real_open != NULL);
+  }
+  shared_lock_fd = real_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (shared_lock_fd < 0) {
+    fprintf(stderr, "open(EKAM_INTERCEPT_LOCK): error %d\n", errno);
+    abort();
+  }
+  return 1;
+}
+
+static void lock_call_stream() {
+  flockfile(ekam_call_stream);
+  if (use_shared_lock()) {
+    while (flock(shared_lock_fd, LOCK_EX) < 0) {
+      if (errno != EINTR) {
+        fprintf(stderr, "flock(EKAM_INTERCEPT_LOCK): error %d\n", errno);
+        abort();
+      }
+    }
+  }
+}
+
+static void unlock_call_stream() {
+  if (shared_lock_fd >= 0) {
+    flock(shared_lock_fd, LOCK_UN);
+  }
+  funlockfile(ekam_call_stream);
+}
+
 /****************************************************************************************/
 
 typedef enum usage {
@@ -312,7 +364,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
     return buffer;
   }
 
-  flockfile(ekam_call_stream);
+  lock_call_stream();
 
   if (strncmp(pathname, TAG_PROVIDER_PREFIX, strlen(TAG_PROVIDER_PREFIX)) == 0) {
     /* A tag reference.  Construct the tag name in |buffer|. */
@@ -325,7 +377,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
       if (pos == NULL) {
         /* This appears to be a tag type without a name, so it should look like a directory.
          * We can use the current directory.  TODO:  Return some fake empty directory instead. */
-        funlockfile(ekam_call_stream);
+        unlock_call_stream();
         strcpy(buffer, ".");
         if (debug) fprintf(stderr, "  is directory\n");
         return buffer;
@@ -335,7 +387,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
 
       if (strcmp(buffer, "canonical:.") == 0) {
         /* HACK:  Don't try to remap top directory. */
-        funlockfile(ekam_call_stream);
+        unlock_call_stream();
         if (debug) fprintf(stderr, "  current directory\n");
         return "src";
       }
@@ -351,7 +403,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
              strncmp(pathname, VAR_TMP_PREFIX, strlen(VAR_TMP_PREFIX)) == 0 ||
              strncmp(pathname, PROC_PREFIX, strlen(PROC_PREFIX)) == 0) {
     /* Temp file or /proc.  Ignore. */
-    funlockfile(ekam_call_stream);
+    unlock_call_stream();
     if (debug) fprintf(stderr, "  temp file: %s\n", pathname);
     return pathname;
   } else {
@@ -367,7 +419,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
       /* Absolute path or under `deps`.  Note the access but don't remap. */
       if (usage == WRITE) {
         /* Cannot write to absolute paths. */
-        funlockfile(ekam_call_stream);
+        unlock_call_stream();
         errno = EACCES;
         if (debug) fprintf(stderr, "  absolute path, can't write\n");
         return NULL;
@@ -378,12 +430,12 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
       fputs("\n", ekam_call_stream);
       fflush(ekam_call_stream);
       if (ferror_unlocked(ekam_call_stream)) {
-        funlockfile(ekam_call_stream);
+        unlock_call_stream();
         fprintf(stderr, "error: Ekam call stream broken.\n");
         abort();
       }
       cache_result(pathname, pathname, usage);
-      funlockfile(ekam_call_stream);
+      unlock_call_stream();
       if (debug) fprintf(stderr, "  absolute path: %s\n", pathname);
       return pathname;
     }
@@ -393,7 +445,7 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
     canonicalizePath(buffer);
     if (strcmp(buffer, ".") == 0) {
       /* HACK:  Don't try to remap current directory. */
-      funlockfile(ekam_call_stream);
+      unlock_call_stream();
       if (debug) fprintf(stderr, "  current directory\n");
       return ".";
     } else {
@@ -406,15 +458,18 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
 
   fflush(ekam_call_stream);
   if (ferror_unlocked(ekam_call_stream)) {
-    funlockfile(ekam_call_stream);
+    unlock_call_stream();
     fprintf(stderr, "error: Ekam call stream broken.\n");
     abort();
   }
 
   /* Carefully lock the return stream then unlock the call stream, so that we know that
-   * responses will be received in the correct order. */
+   * responses will be received in the correct order.  Other processes don't respect our stdio
+   * locks, though, so with a shared connection we must hold the whole exchange. */
   flockfile(ekam_return_stream);
-  funlockfile(ekam_call_stream);
+  if (shared_lock_fd < 0) {
+    unlock_call_stream();
+  }
 
   /* Read response from Ekam. */
   if (fgets(buffer, PATH_MAX, ekam_return_stream) == NULL) {
@@ -425,6 +480,9 @@ static const char* remap_file(const char* syscall_name, const char* pathname,
 
   /* Done reading. */
   funlockfile(ekam_return_stream);
+  if (shared_lock_fd >= 0) {
+    unlock_call_stream();
+  }
 
   /* Remove the trailing newline. */
   pos = strchr(buffer, '\n');
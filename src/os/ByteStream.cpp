@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -56,6 +57,10 @@ size_t ByteStream::write(const void* buffer, size_t size) {
   return WRAP_SYSCALL(write, handle, buffer, size);
 }
 
+size_t ByteStream::writev(const struct iovec* pieces, int count) {
+  return WRAP_SYSCALL(writev, handle, pieces, count);
+}
+
 void ByteStream::writeAll(const void* buffer, size_t size) {
   const char* cbuffer = reinterpret_cast<const char*>(buffer);
 
@@ -19,6 +19,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <stdexcept>
 
 #include "base/OwnedPtr.h"
@@ -42,6 +43,7 @@ public:
   size_t read(void* buffer, size_t size);
   Promise<size_t> readAsync(EventManager* eventManager, void* buffer, size_t size);
   size_t write(const void* buffer, size_t size);
+  size_t writev(const struct iovec* pieces, int count);
   void writeAll(const void* buffer, size_t size);
   void stat(struct stat* stats);
 
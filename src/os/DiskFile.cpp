@@ -26,6 +26,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unordered_map>
+#include <vector>
 
 #include "base/Debug.h"
 #include "os/OsHandle.h"
@@ -92,11 +93,57 @@ bool statIfExists(const std::string& path, struct stat* output) {
 
 }  // anonymous namespace
 
-DiskFile::DiskFile(const std::string& path, File* parent) : path(path) {
+struct DiskFile::Identity {
+  std::string path;
+  std::string canonicalName;
+  Identity* parent;  // null for top-level directories
+};
+
+DiskFile::Identity* DiskFile::intern(const std::string& path, File* parent) {
+  // A path is normally always reached through the same parent, so each list is usually one
+  // long.  If not, each parent gets its own Identity, since the canonical names differ.
+  static std::unordered_map<std::string, std::vector<Identity*> > identities;
+
+  Identity* parentIdentity = NULL;
   if (parent != NULL) {
-    this->parentRef = parent->clone();
+    DiskFile* diskParent = dynamic_cast<DiskFile*>(parent);
+    if (diskParent == NULL) {
+      throw std::invalid_argument("Parent of disk file must be a disk file: " + path);
+    }
+    parentIdentity = diskParent->identity;
+  }
+
+  std::vector<Identity*>& slot = identities[path];
+  for (Identity* identity: slot) {
+    if (identity->parent == parentIdentity) {
+      return identity;
+    }
   }
+
+  Identity* result = new Identity;
+  result->path = path;
+  result->parent = parentIdentity;
+
+  if (parentIdentity == NULL) {
+    result->canonicalName = ".";
+  } else {
+    std::string::size_type slashPos = path.find_last_of('/');
+    if (parentIdentity->canonicalName != ".") {
+      result->canonicalName = parentIdentity->canonicalName;
+      result->canonicalName.push_back('/');
+    }
+    result->canonicalName.append(
+        slashPos == std::string::npos ? path : path.substr(slashPos + 1));
+  }
+
+  slot.push_back(result);
+  return result;
 }
+
+DiskFile::DiskFile(const std::string& path, File* parent)
+    : DiskFile(intern(path, parent)) {}
+DiskFile::DiskFile(Identity* identity)
+    : File(identity), identity(identity), path(identity->path) {}
 DiskFile::~DiskFile() {}
 
 std::string DiskFile::basename() {
@@ -113,43 +160,22 @@ std::string DiskFile::basename() {
 }
 
 std::string DiskFile::canonicalName() {
-  if (parentRef == NULL) {
-    return ".";
-  }
-
-  std::string result = parentRef->canonicalName();
-  if (result == ".") {
-    result.clear();
-  } else {
-    result.push_back('/');
-  }
-  result.append(basename());
-
-  return result;
+  return identity->canonicalName;
 }
 
 OwnedPtr<File> DiskFile::clone() {
-  return newOwned<DiskFile>(path, parentRef.get());
+  return newOwned<DiskFile>(identity);
 }
 
 bool DiskFile::hasParent() {
-  return parentRef != NULL;
+  return identity->parent != NULL;
 }
 
 OwnedPtr<File> DiskFile::parent() {
-  if (parentRef == NULL) {
+  if (identity->parent == NULL) {
     throw std::runtime_error("Tried to get parent of top-level directory: " + canonicalName());
   }
-  return parentRef->clone();
-}
-
-bool DiskFile::equals(File* other) {
-  DiskFile* otherDiskFile = dynamic_cast<DiskFile*>(other);
-  return otherDiskFile != NULL && otherDiskFile->path == path;
-}
-
-size_t DiskFile::identityHash() {
-  return std::hash<std::string>()(path);
+  return newOwned<DiskFile>(identity->parent);
 }
 
 class DiskFile::DiskRefImpl : public File::DiskRef {
@@ -308,11 +334,7 @@ OwnedPtr<File> DiskFile::relative(const std::string& path) {
       if (first_part == ".") {
         return relative(rest);
       } else if (first_part == "..") {
-        if (parentRef == NULL) {
-          throw std::runtime_error(
-              "Tried to get parent of top-level directory: " + canonicalName());
-        }
-        return parentRef->relative(rest);
+        return parent()->relative(rest);
       } else {
         OwnedPtr<File> temp;
         if (this->path.empty()) {
@@ -23,8 +23,12 @@
 namespace ekam {
 
 class DiskFile: public File {
+private:
+  struct Identity;
+
 public:
   DiskFile(const std::string& path, File* parent);
+  explicit DiskFile(Identity* identity);  // for clone() and friends
   ~DiskFile();
 
   // implements File ---------------------------------------------------------------------
@@ -34,9 +38,6 @@ public:
   bool hasParent();
   OwnedPtr<File> parent();
 
-  bool equals(File* other);
-  size_t identityHash();
-
   OwnedPtr<DiskRef> getOnDisk(Usage usage);
 
   bool exists();
@@ -61,8 +62,13 @@ public:
 private:
   class DiskRefImpl;
 
-  std::string path;
-  OwnedPtr<File> parentRef;
+  // Every DiskFile with a given path and parent shares a single interned Identity, which is
+  // never freed.  This makes clone() and parent() cheap, and the Identity's address serves as
+  // the File's identity.
+  Identity* identity;
+  const std::string& path;  // identity->path
+
+  static Identity* intern(const std::string& path, File* parent);
 };
 
 }  // namespace ekam
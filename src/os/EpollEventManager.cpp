@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
 #include <sys/inotify.h>
@@ -41,6 +42,12 @@ namespace ekam {
 
 namespace {
 
+uint64_t monotonicMicros() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return static_cast<uint64_t>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
 std::string epollEventsToString(uint32_t events) {
   std::string result;
   if (events == 0) {
@@ -187,7 +194,7 @@ void EpollEventManager::Epoller::Watch::updateRegistration() {
   WRAP_SYSCALL(epoll_ctl, epoller->epollHandle, op, fd, &event);
 }
 
-bool EpollEventManager::Epoller::handleEvent() {
+bool EpollEventManager::Epoller::handleEvent(EventLoopStats* stats) {
   // Run pending updates.
   for (Watch* watch : watchesNeedingUpdate) {
     watch->updateRegistration();
@@ -211,7 +218,10 @@ bool EpollEventManager::Epoller::handleEvent() {
   Watch* watch = reinterpret_cast<Watch*>(event.data.ptr);
   DEBUG_INFO << "epoll event: " << watch->name << ":" << epollEventsToString(event.events);
 
+  uint64_t start = monotonicMicros();
   watch->handler->handle(event.events);
+  ++stats->ioEvents;
+  stats->busyMicros += monotonicMicros() - start;
 
   return true;
 }
@@ -273,7 +283,8 @@ void EpollEventManager::SignalHandler::maybeStopExpecting() {
 class EpollEventManager::AsyncCallbackHandler : public PendingRunnable {
 public:
   AsyncCallbackHandler(EpollEventManager* eventManager, OwnedPtr<Runnable> runnable)
-      : eventManager(eventManager), called(false), runnable(runnable.release()) {
+      : eventManager(eventManager), called(false), runnable(runnable.release()),
+        queuedTime(monotonicMicros()) {
     eventManager->asyncCallbacks.push_back(this);
   }
   ~AsyncCallbackHandler() {
@@ -291,13 +302,22 @@ public:
 
   void run() {
     called = true;
-    runnable->run();
+
+    EventLoopStats* stats = &eventManager->stats;
+    uint64_t start = monotonicMicros();
+    stats->addWait(start - queuedTime);
+    ++stats->callbacksRun;
+
+    runnable->run();  // may delete this
+
+    stats->busyMicros += monotonicMicros() - start;
   }
 
 private:
   EpollEventManager* eventManager;
   bool called;
   OwnedPtr<Runnable> runnable;
+  uint64_t queuedTime;
 };
 
 OwnedPtr<PendingRunnable> EpollEventManager::runLater(OwnedPtr<Runnable> runnable) {
@@ -324,21 +344,24 @@ public:
     }
   }
 
-  void handle(int waitStatus) {
+  void handle(int waitStatus, const ResourceUsage& usage) {
     DEBUG_INFO << "Process " << pid << " exited with status: " << waitStatus;
 
     signalHandler->processExitHandlerMap.erase(pid);
     signalHandler->maybeStopExpecting();
     pid = -1;
 
+    ProcessExitCode exitCode;
     if (WIFEXITED(waitStatus)) {
-      callback->fulfill(ProcessExitCode(WEXITSTATUS(waitStatus)));
+      exitCode = ProcessExitCode(WEXITSTATUS(waitStatus));
     } else if (WIFSIGNALED(waitStatus)) {
-      callback->fulfill(ProcessExitCode(ProcessExitCode::SIGNALED, WTERMSIG(waitStatus)));
+      exitCode = ProcessExitCode(ProcessExitCode::SIGNALED, WTERMSIG(waitStatus));
     } else {
       DEBUG_ERROR << "Didn't understand process exit status.";
-      callback->fulfill(ProcessExitCode(-1));
+      exitCode = ProcessExitCode(-1);
     }
+    exitCode.setResourceUsage(usage);
+    callback->fulfill(exitCode);
   }
 
 private:
@@ -351,15 +374,16 @@ void EpollEventManager::SignalHandler::handleProcessExit() {
   // If multiple signals with the same signal number are delivered while signals are blocked,
   // only one of them is actually delivered once un-blocked.  The others are cast into the
   // void.  Therefore, the contents of the siginfo structure are effectively useless for
-  // SIGCHLD.  We must instead call waitpid() repeatedly until there are no more completed
+  // SIGCHLD.  We must instead call wait4() repeatedly until there are no more completed
   // children.  Signals suck so much.
   while (true) {
     int waitStatus;
-    pid_t pid = waitpid(-1, &waitStatus, WNOHANG);
+    struct rusage usage;
+    pid_t pid = wait4(-1, &waitStatus, WNOHANG, &usage);
     if (pid < 0) {
       // ECHILD indicates there are no child processes.  Anything else is a real error.
       if (errno != ECHILD) {
-        DEBUG_ERROR << "waitpid: " << strerror(errno);
+        DEBUG_ERROR << "wait4: " << strerror(errno);
       }
       break;
     } else if (pid == 0) {
@@ -381,7 +405,7 @@ void EpollEventManager::SignalHandler::handleProcessExit() {
       return;
     }
 
-    iter->second->handle(waitStatus);
+    iter->second->handle(waitStatus, ResourceUsage(usage));
   }
 }
 
@@ -420,7 +444,7 @@ public:
   }
 
   Promise<void> onWritable() {
-    if (readFulfiller != nullptr) {
+    if (writeFulfiller != nullptr) {
       throw std::logic_error("Already waiting for writability on this fd.");
     }
     return newPromise<Fulfiller>(&watch, EPOLLOUT, &writeFulfiller);
@@ -849,7 +873,13 @@ bool EpollEventManager::handleEvent() {
     return true;
   }
 
-  return epoller.handleEvent();
+  return epoller.handleEvent(&stats);
+}
+
+EventLoopStats EpollEventManager::getStats() {
+  EventLoopStats result = stats;
+  result.queuedCallbacks = asyncCallbacks.size();
+  return result;
 }
 
 // =======================================================================================
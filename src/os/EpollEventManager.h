@@ -41,6 +41,7 @@ public:
 
   // implements RunnableEventManager -----------------------------------------------------
   void loop();
+  EventLoopStats getStats();
 
   // implements Executor -----------------------------------------------------------------
   OwnedPtr<PendingRunnable> runLater(OwnedPtr<Runnable> runnable);
@@ -66,7 +67,7 @@ private:
     Epoller();
     ~Epoller();
 
-    bool handleEvent();
+    bool handleEvent(EventLoopStats* stats);
 
     class Watch {
     public:
@@ -148,6 +149,7 @@ private:
   InotifyHandler inotifyHandler;
 
   std::deque<AsyncCallbackHandler*> asyncCallbacks;
+  EventLoopStats stats;
 
   bool handleEvent();
 };
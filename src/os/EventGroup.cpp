@@ -21,6 +21,7 @@
 namespace ekam {
 
 EventGroup::ExceptionHandler::~ExceptionHandler() noexcept(false) {}
+EventGroup::ProcessObserver::~ProcessObserver() noexcept(false) {}
 
 class EventGroup::PendingEvent {
 public:
@@ -67,8 +68,10 @@ private:
 
 // =======================================================================================
 
-EventGroup::EventGroup(EventManager* inner, ExceptionHandler* exceptionHandler)
-    : inner(inner), exceptionHandler(exceptionHandler), eventCount(0) {}
+EventGroup::EventGroup(EventManager* inner, ExceptionHandler* exceptionHandler,
+                       ProcessObserver* processObserver)
+    : inner(inner), exceptionHandler(exceptionHandler), processObserver(processObserver),
+      eventCount(0) {}
 
 EventGroup::~EventGroup() {}
 
@@ -80,7 +83,10 @@ OwnedPtr<PendingRunnable> EventGroup::runLater(OwnedPtr<Runnable> runnable) {
 Promise<ProcessExitCode> EventGroup::onProcessExit(pid_t pid) {
   Promise<ProcessExitCode> innerPromise = inner->onProcessExit(pid);
   return when(innerPromise, newPendingEvent())(
-    [](ProcessExitCode exitCode, OwnedPtr<PendingEvent>) -> ProcessExitCode {
+    [this, pid](ProcessExitCode exitCode, OwnedPtr<PendingEvent>) -> ProcessExitCode {
+      if (processObserver != nullptr) {
+        processObserver->processExited(pid, exitCode);
+      }
       return exitCode;
     });
 }
@@ -44,9 +44,22 @@ public:
     virtual void noMoreEvents() = 0;
   };
 
-  EventGroup(EventManager* inner, ExceptionHandler* exceptionHandler);
+  class ProcessObserver {
+  public:
+    virtual ~ProcessObserver() noexcept(false);
+
+    // A process waited on through this group has exited.  Called before whoever was waiting
+    // hears about it.
+    virtual void processExited(pid_t pid, ProcessExitCode exitCode) = 0;
+  };
+
+  EventGroup(EventManager* inner, ExceptionHandler* exceptionHandler,
+             ProcessObserver* processObserver = nullptr);
   ~EventGroup();
 
+  // True if the group is still waiting for something, i.e. noMoreEvents() is yet to come.
+  bool hasPendingEvents() { return eventCount > 0; }
+
   // implements Executor -----------------------------------------------------------------
   OwnedPtr<PendingRunnable> runLater(OwnedPtr<Runnable> runnable);
 
@@ -64,6 +77,7 @@ private:
 
   EventManager* inner;
   ExceptionHandler* exceptionHandler;
+  ProcessObserver* processObserver;
   int eventCount;
   Promise<void> pendingNoMoreEvents;
 
@@ -17,6 +17,7 @@
 #include "EventManager.h"
 
 #include <stdexcept>
+#include <stdio.h>
 
 #include "OsHandle.h"  // temporary, for toString()
 
@@ -27,6 +28,57 @@ EventManager::IoWatcher::~IoWatcher() noexcept(false) {}
 EventManager::FileWatcher::~FileWatcher() {}
 RunnableEventManager::~RunnableEventManager() noexcept(false) {}
 
+EventLoopStats RunnableEventManager::getStats() {
+  return EventLoopStats();
+}
+
+const int EventLoopStats::WAIT_BUCKET_COUNT;
+const uint64_t EventLoopStats::WAIT_BUCKETS[WAIT_BUCKET_COUNT] = {
+  100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+EventLoopStats::EventLoopStats()
+    : callbacksRun(0), ioEvents(0), busyMicros(0), queuedCallbacks(0), waitHistogram(),
+      totalWaitMicros(0) {}
+
+void EventLoopStats::addWait(uint64_t micros) {
+  totalWaitMicros += micros;
+  for (int i = 0; i < WAIT_BUCKET_COUNT; i++) {
+    if (micros <= WAIT_BUCKETS[i]) {
+      ++waitHistogram[i];
+      break;
+    }
+  }
+}
+
+ResourceUsage::ResourceUsage()
+    : userMicros(0), systemMicros(0), maxRssKb(0), blockInputs(0), blockOutputs(0),
+      voluntarySwitches(0), involuntarySwitches(0) {}
+
+ResourceUsage::ResourceUsage(const struct rusage& usage)
+    : userMicros(usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec),
+      systemMicros(usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec),
+      maxRssKb(usage.ru_maxrss),  // kilobytes on Linux
+      blockInputs(usage.ru_inblock), blockOutputs(usage.ru_oublock),
+      voluntarySwitches(usage.ru_nvcsw), involuntarySwitches(usage.ru_nivcsw) {}
+
+void ResourceUsage::add(const ResourceUsage& other) {
+  userMicros += other.userMicros;
+  systemMicros += other.systemMicros;
+  if (other.maxRssKb > maxRssKb) maxRssKb = other.maxRssKb;
+  blockInputs += other.blockInputs;
+  blockOutputs += other.blockOutputs;
+  voluntarySwitches += other.voluntarySwitches;
+  involuntarySwitches += other.involuntarySwitches;
+}
+
+std::string ResourceUsage::toString() const {
+  char buffer[128];
+  snprintf(buffer, sizeof(buffer), "%.2fs user, %.2fs sys, %.1f MB peak",
+           userMicros / 1e6, systemMicros / 1e6, maxRssKb / 1024.0);
+  return buffer;
+}
+
 void ProcessExitCode::throwError() {
   if (signaled) {
     throw std::logic_error("Process was signaled: " + toString(exitCodeOrSignal));
@@ -18,13 +18,37 @@
 #define KENTONSCODE_OS_EVENTMANAGER_H_
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <string>
 #include "base/OwnedPtr.h"
 #include "base/Promise.h"
 
 namespace ekam {
 
+// What a process used over its lifetime, including any children it waited for, as reported
+// by wait4().
+struct ResourceUsage {
+  ResourceUsage();
+  explicit ResourceUsage(const struct rusage& usage);
+
+  long long userMicros;
+  long long systemMicros;
+  long long maxRssKb;  // peak resident set size
+  long long blockInputs;
+  long long blockOutputs;
+  long long voluntarySwitches;
+  long long involuntarySwitches;
+
+  // Accumulate another process's usage.  Times and counts add up; the peak RSS is the larger
+  // of the two, since there's no telling whether the processes' peaks overlapped.
+  void add(const ResourceUsage& other);
+
+  // E.g. "1.23s user, 0.10s sys, 85.2 MB peak".
+  std::string toString() const;
+};
+
 class ProcessExitCode {
 public:
   ProcessExitCode(): signaled(false), exitCodeOrSignal(0) {}
@@ -52,9 +76,18 @@ public:
     return exitCodeOrSignal;
   }
 
+  // All zero if the event manager doesn't collect it.
+  const ResourceUsage& getResourceUsage() {
+    return resourceUsage;
+  }
+  void setResourceUsage(const ResourceUsage& usage) {
+    resourceUsage = usage;
+  }
+
 private:
   bool signaled;
   int exitCodeOrSignal;
+  ResourceUsage resourceUsage;
 
   void throwError();
 };
@@ -95,11 +128,34 @@ public:
   virtual OwnedPtr<FileWatcher> watchFile(const std::string& filename) = 0;
 };
 
+// Counters kept by an event loop, for metrics.  Times are in microseconds.
+struct EventLoopStats {
+  EventLoopStats();
+
+  uint64_t callbacksRun;  // via runLater()
+  uint64_t ioEvents;      // fd, signal, and inotify events
+  uint64_t busyMicros;    // spent running callbacks and handling events, i.e. not waiting
+  size_t queuedCallbacks;  // waiting to run right now
+
+  // How long callbacks waited between runLater() and running, i.e. how far behind the loop is.
+  // waitHistogram[i] counts waits longer than WAIT_BUCKETS[i - 1] but no longer than
+  // WAIT_BUCKETS[i].  Longer waits count only toward totalWaitMicros.
+  static const int WAIT_BUCKET_COUNT = 6;
+  static const uint64_t WAIT_BUCKETS[WAIT_BUCKET_COUNT];
+  uint64_t waitHistogram[WAIT_BUCKET_COUNT];
+  uint64_t totalWaitMicros;
+
+  void addWait(uint64_t micros);
+};
+
 class RunnableEventManager : public EventManager {
 public:
   virtual ~RunnableEventManager() noexcept(false);
 
   virtual void loop() = 0;
+
+  // All zero if the implementation doesn't keep counters.
+  virtual EventLoopStats getStats();
 };
 
 OwnedPtr<RunnableEventManager> newPreferredEventManager();
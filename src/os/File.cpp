@@ -15,10 +15,14 @@
 // limitations under the License.
 
 #include "File.h"
+#include <assert.h>
 #include <string>
 
 namespace ekam {
 
+File::File(const void* identity) : fileIdentity(identity) {
+  assert(identity != nullptr);
+}
 File::~File() {}
 File::DiskRef::~DiskRef() {};
 
@@ -17,6 +17,8 @@
 #ifndef KENTONSCODE_OS_FILE_H_
 #define KENTONSCODE_OS_FILE_H_
 
+#include <stddef.h>
+#include <functional>
 #include <vector>
 #include <iterator>
 
@@ -28,6 +30,9 @@ class Hash;
 
 class File {
 public:
+  // `identity` must be non-null, and shared by exactly those File objects which refer to the
+  // same file.
+  explicit File(const void* identity);
   virtual ~File();
 
   virtual std::string basename() = 0;
@@ -36,8 +41,14 @@ public:
   virtual bool hasParent() = 0;
   virtual OwnedPtr<File> parent() = 0;
 
-  virtual bool equals(File* other) = 0;
-  virtual size_t identityHash() = 0;
+  // Files are the same file exactly when they have the same identity, which implementations
+  // pass to the constructor.  Comparing identities is cheap, so maps keyed on files use these.
+  inline bool equals(File* other) {
+    return other->fileIdentity == fileIdentity;
+  }
+  inline size_t identityHash() {
+    return std::hash<const void*>()(fileIdentity);
+  }
 
   class HashFunc {
   public:
@@ -84,6 +95,9 @@ public:
   virtual void createDirectory() = 0;
   virtual void link(File* target) = 0;
   virtual void unlink() = 0;
+
+private:
+  const void* const fileIdentity;
 };
 
 void splitExtension(const std::string& name, std::string* base, std::string* ext);
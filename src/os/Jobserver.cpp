@@ -0,0 +1,120 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Jobserver.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OsHandle.h"
+#include "base/Debug.h"
+
+namespace ekam {
+
+Jobserver::Jobserver(int tokens) : tokens(tokens) {
+  if (pipe(fds) != 0) {
+    throw OsError("", "pipe", errno);
+  }
+
+  // To get a non-blocking read end without affecting the children's, we must open the pipe
+  // a second time, creating a separate file description.
+  std::string path = "/proc/self/fd/" + toString(fds[0]);
+  nonblockingReadFd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (nonblockingReadFd < 0) {
+    int error = errno;
+    close(fds[0]);
+    close(fds[1]);
+    throw OsError(path, "open", error);
+  }
+
+  // The write end doesn't need to be non-blocking:  the pipe never holds more than `tokens`
+  // bytes.
+  std::string pool(tokens, '+');
+  WRAP_SYSCALL(write, fds[1], pool.data(), pool.size());
+}
+
+Jobserver::~Jobserver() {
+  close(nonblockingReadFd);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+void Jobserver::exportToEnvironment(int jobCount) {
+  std::string flags = "-j" + toString(jobCount) + " --jobserver-auth=" +
+                      toString(fds[0]) + "," + toString(fds[1]);
+
+  const char* existing = getenv("MAKEFLAGS");
+  if (existing != NULL && *existing != '\0') {
+    flags = std::string(existing) + " " + flags;
+  }
+
+  setenv("MAKEFLAGS", flags.c_str(), 1);
+}
+
+bool Jobserver::tryAcquire() {
+  char token;
+  ssize_t n;
+  do {
+    n = read(nonblockingReadFd, &token, 1);
+  } while (n < 0 && errno == EINTR);
+
+  if (n == 1) {
+    ++held;
+    return true;
+  } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    throw OsError("jobserver", "read", errno);
+  }
+  return false;
+}
+
+void Jobserver::release() {
+  WRAP_SYSCALL(write, fds[1], "+", 1);
+  --held;
+}
+
+Promise<void> Jobserver::onAvailable(EventManager* eventManager) {
+  if (watcher == nullptr) {
+    watcher = eventManager->watchFd(nonblockingReadFd);
+  }
+  return watcher->onReadable();
+}
+
+void Jobserver::refill() {
+  // Empty the pipe, then put back exactly what belongs there.  Simply topping it up would
+  // count tokens still out with orphans twice, once they came back.
+  int expected = tokens - held;
+  int found = 0;
+  while (tryAcquire()) {
+    ++found;
+  }
+  held -= found;
+
+  if (found < expected) {
+    DEBUG_INFO << "jobserver: recovered " << (expected - found) << " leaked tokens";
+  } else if (found > expected) {
+    DEBUG_INFO << "jobserver: dropped " << (found - expected) << " tokens returned late";
+  }
+
+  if (expected > 0) {
+    std::string pool(expected, '+');
+    WRAP_SYSCALL(write, fds[1], pool.data(), pool.size());
+  }
+}
+
+}  // namespace ekam
@@ -0,0 +1,69 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef KENTONSCODE_OS_JOBSERVER_H_
+#define KENTONSCODE_OS_JOBSERVER_H_
+
+#include <string>
+
+#include "base/OwnedPtr.h"
+#include "EventManager.h"
+
+namespace ekam {
+
+// A GNU make-compatible jobserver.  This is a pipe holding one byte per job slot that may be
+// borrowed.  Child processes inherit the pipe and learn about it through MAKEFLAGS; compatible
+// tools (make, cargo, GCC's -flto=jobserver, etc.) read a byte before starting each job beyond
+// their first and write it back when the job is done.  Ekam itself takes tokens from the same
+// pool, so that the total number of jobs never exceeds the pool size plus one.
+class Jobserver {
+public:
+  explicit Jobserver(int tokens);
+  ~Jobserver();
+
+  // Adds the jobserver to MAKEFLAGS in this process's environment, so that all subprocesses
+  // see it.  `jobCount` is reported as the -j value.
+  void exportToEnvironment(int jobCount);
+
+  // Takes a token if one is available.  Never blocks.
+  bool tryAcquire();
+  void release();
+
+  // Fulfilled when a token might be available.
+  Promise<void> onAvailable(EventManager* eventManager);
+
+  // Puts the pool back to its original size, less the tokens ekam holds, recovering any
+  // tokens that children took and never returned (e.g. because they were killed).  Tokens
+  // returned late, by orphaned grandchildren, are dropped by the next refill rather than left to
+  // grow the pool past its size.  Only call when no children are running.
+  void refill();
+
+private:
+  int tokens;
+  int held = 0;  // taken by tryAcquire() and not yet released
+
+  // The ends of the pipe handed to children.  These must stay blocking, since some clients
+  // expect that, and O_NONBLOCK would be shared with them.
+  int fds[2];
+
+  // Our own, separately-opened, non-blocking read end.
+  int nonblockingReadFd;
+  OwnedPtr<EventManager::IoWatcher> watcher;
+};
+
+}  // namespace ekam
+
+#endif  // KENTONSCODE_OS_JOBSERVER_H_
@@ -109,7 +109,17 @@ ServerSocket::~ServerSocket() {}
 Promise<OwnedPtr<ByteStream>> ServerSocket::accept() {
   return eventManager->when(watcher->onReadable())(
     [this](Void) -> Promise<OwnedPtr<ByteStream>> {
+      // Accepted connections are non-blocking, like the listening socket, so that a peer which
+      // stops reading can't stall the event loop.
+#ifdef SOCK_NONBLOCK
+      int fd = ::accept4(handle.get(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
       int fd = ::accept(handle.get(), NULL, NULL);
+      if (fd >= 0) {
+        WRAP_SYSCALL(fcntl, fd, F_SETFL, O_NONBLOCK);
+        WRAP_SYSCALL(fcntl, fd, F_SETFD, FD_CLOEXEC);
+      }
+#endif
       if (fd < 0) {
         switch (errno) {
           case EINTR:
@@ -0,0 +1,53 @@
+// Ekam Build System
+// Author: Kenton Varda (kenton@sandstorm.io)
+// Copyright (c) 2010-2015 Kenton Varda, Google Inc., and contributors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "Timer.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+namespace ekam {
+
+Timer::Timer(EventManager* eventManager)
+    : eventManager(eventManager),
+      handle("timerfd",
+             WRAP_SYSCALL(timerfd_create, CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      watcher(eventManager->watchFd(handle.get())) {}
+
+Timer::~Timer() {}
+
+Promise<void> Timer::after(long milliseconds) {
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
+  spec.it_value.tv_sec = milliseconds / 1000;
+  spec.it_value.tv_nsec = (milliseconds % 1000) * 1000000;
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    // Zero would disarm the timer.
+    spec.it_value.tv_nsec = 1;
+  }
+  WRAP_SYSCALL(timerfd_settime, handle, 0, &spec, nullptr);
+
+  return eventManager->when(watcher->onReadable())(
+    [this](Void) {
+      // Consume the expiration so that the fd stops being readable.
+      uint64_t expirations;
+      WRAP_SYSCALL(read, handle, &expirations, sizeof(expirations));
+    });
+}
+
+}  // namespace ekam